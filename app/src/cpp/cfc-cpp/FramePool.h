@@ -0,0 +1,78 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// fixed set of frame buffers, reused across camera frames.
+// a buffer is owned by whoever acquire()d it until they release() it -- typically, the decode task it was handed to.
+// buffers keep their allocation, so copying a same-sized frame in is just the memcpy.
+class FramePool
+{
+public:
+	FramePool(unsigned size);
+
+	int acquire();
+	void release(int idx);
+
+	cv::Mat& buffer(int idx);
+
+	unsigned size() const;
+	unsigned in_use() const;
+
+protected:
+	std::vector<cv::Mat> _buffers;
+	std::unique_ptr<std::atomic<bool>[]> _busy;
+	std::atomic<unsigned> _inUse;
+};
+
+inline FramePool::FramePool(unsigned size)
+	: _buffers(size)
+	, _busy(new std::atomic<bool>[size])
+	, _inUse(0)
+{
+	for (unsigned i = 0; i < size; ++i)
+		_busy[i] = false;
+}
+
+// returns -1 if every buffer is spoken for
+inline int FramePool::acquire()
+{
+	if (_inUse.load(std::memory_order_relaxed) >= _buffers.size())
+		return -1;
+
+	for (unsigned i = 0; i < _buffers.size(); ++i)
+	{
+		bool expected = false;
+		if (!_busy[i].load(std::memory_order_relaxed) and _busy[i].compare_exchange_strong(expected, true, std::memory_order_acquire))
+		{
+			++_inUse;
+			return i;
+		}
+	}
+	return -1;
+}
+
+inline void FramePool::release(int idx)
+{
+	if (idx < 0 or (unsigned)idx >= _buffers.size())
+		return;
+	--_inUse;
+	_busy[idx].store(false, std::memory_order_release);
+}
+
+inline cv::Mat& FramePool::buffer(int idx)
+{
+	return _buffers[idx];
+}
+
+inline unsigned FramePool::size() const
+{
+	return _buffers.size();
+}
+
+inline unsigned FramePool::in_use() const
+{
+	return _inUse;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "FramePool.h"
+#include "concurrent/thread_pool.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// latest-frame-wins scheduling.
+// there is a single pending slot: posting a frame while one is already waiting replaces (and recycles) the stale one.
+// up to max_workers pool tasks drain the slot, so a worker that frees up always picks up the freshest frame.
+class FrameScheduler
+{
+public:
+	using process_fun = std::function<void(const cv::Mat&, unsigned)>;
+
+	FrameScheduler(turbo::thread_pool& pool, unsigned max_workers, const process_fun& fun);
+
+	bool post(const cv::Mat& mat, unsigned tag);
+
+	unsigned pending() const;
+	unsigned active_workers() const;
+	// nothing waiting, and nothing being processed
+	bool idle() const;
+
+	// at most max_workers (from the constructor). Workers above the new limit step down after their current frame.
+	void set_worker_limit(unsigned limit);
+	unsigned worker_limit() const;
+
+	uint64_t dropped() const;
+	uint64_t replaced() const;
+	uint64_t taken() const;
+
+protected:
+	bool claim_worker();
+	void drain();
+
+protected:
+	turbo::thread_pool& _pool;
+	unsigned _maxWorkers;
+	std::atomic<unsigned> _workerLimit;
+	process_fun _process;
+
+	// one buffer per worker, one pending, one being filled by post()
+	FramePool _frames;
+	std::vector<unsigned> _tags;
+	std::atomic<int> _pending;
+	std::atomic<unsigned> _activeWorkers;
+
+	std::atomic<uint64_t> _dropped;
+	std::atomic<uint64_t> _replaced;
+	std::atomic<uint64_t> _taken;
+};
+
+inline FrameScheduler::FrameScheduler(turbo::thread_pool& pool, unsigned max_workers, const process_fun& fun)
+	: _pool(pool)
+	, _maxWorkers(max_workers)
+	, _workerLimit(max_workers)
+	, _process(fun)
+	, _frames(max_workers + 2)
+	, _tags(max_workers + 2, 0)
+	, _pending(-1)
+	, _activeWorkers(0)
+	, _dropped(0)
+	, _replaced(0)
+	, _taken(0)
+{
+}
+
+inline bool FrameScheduler::post(const cv::Mat& mat, unsigned tag)
+{
+	// only happens if post() is racing itself
+	int idx = _frames.acquire();
+	if (idx < 0)
+	{
+		++_dropped;
+		return false;
+	}
+
+	mat.copyTo(_frames.buffer(idx));
+	_tags[idx] = tag;
+
+	int stale = _pending.exchange(idx, std::memory_order_acq_rel);
+	if (stale >= 0)
+	{
+		_frames.release(stale);
+		++_replaced;
+	}
+
+	if (claim_worker())
+		_pool.execute( [this] () { drain(); } );
+	return true;
+}
+
+inline bool FrameScheduler::claim_worker()
+{
+	unsigned active = _activeWorkers.load();
+	while (active < _workerLimit.load())
+		if (_activeWorkers.compare_exchange_weak(active, active+1))
+			return true;
+	return false;
+}
+
+inline void FrameScheduler::drain()
+{
+	do {
+		int idx;
+		while (_activeWorkers.load() <= _workerLimit.load() and (idx = _pending.exchange(-1, std::memory_order_acq_rel)) >= 0)
+		{
+			++_taken;
+			_process(_frames.buffer(idx), _tags[idx]);
+			_frames.release(idx);
+		}
+		--_activeWorkers;
+		// a frame may have been posted after we last looked, but before we stepped down -- and post() saw us as busy.
+	} while (_pending.load() >= 0 and claim_worker());
+}
+
+inline unsigned FrameScheduler::pending() const
+{
+	return _pending.load() >= 0;
+}
+
+inline unsigned FrameScheduler::active_workers() const
+{
+	return _activeWorkers;
+}
+
+inline bool FrameScheduler::idle() const
+{
+	return _pending.load() < 0 and _activeWorkers.load() == 0;
+}
+
+inline void FrameScheduler::set_worker_limit(unsigned limit)
+{
+	_workerLimit = std::max(1U, std::min(limit, _maxWorkers));
+}
+
+inline unsigned FrameScheduler::worker_limit() const
+{
+	return _workerLimit;
+}
+
+inline uint64_t FrameScheduler::dropped() const
+{
+	return _dropped;
+}
+
+inline uint64_t FrameScheduler::replaced() const
+{
+	return _replaced;
+}
+
+inline uint64_t FrameScheduler::taken() const
+{
+	return _taken;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "cimb_translator/Config.h"
+#include "extractor/Anchor.h"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+// picks a decode mode per frame, from the anchors Scanner found.
+// the modes' grids have different aspect ratios (B and 4C are square, Bu is ~7:6, Bm is ~3:2), so that's what we measure.
+// the square modes look identical, so we alternate between them.
+// once a mode decodes, it sticks -- until enough frames in a row fail to decode with it.
+class ModeDetector
+{
+public:
+	ModeDetector(unsigned max_failures=6);
+
+	// 0 == not enough anchors to tell
+	static int classify(const std::vector<Anchor>& anchors);
+
+	int pick(const std::vector<Anchor>& anchors);
+	void report(int mode_val, bool success);
+	void reset();
+
+	int current() const;
+
+protected:
+	static double expected_ratio(int mode_val);
+	static double edge(const point<int>& a, const point<int>& b);
+
+protected:
+	unsigned _maxFailures;
+	std::atomic<int> _sticky;
+	std::atomic<unsigned> _failures;
+	std::atomic<unsigned> _squareGuesses;
+};
+
+inline ModeDetector::ModeDetector(unsigned max_failures)
+	: _maxFailures(max_failures)
+	, _sticky(0)
+	, _failures(0)
+	, _squareGuesses(0)
+{
+}
+
+inline double ModeDetector::expected_ratio(int mode_val)
+{
+	// anchor centers get deskewed to anchor_size() in from each edge
+	cimbar::conf cc = cimbar::Config::temp_conf(mode_val);
+	double inset = cimbar::Config::anchor_size() * 2;
+	return (cc.image_size_x - inset) / (cc.image_size_y - inset);
+}
+
+inline double ModeDetector::edge(const point<int>& a, const point<int>& b)
+{
+	return std::sqrt(a.squared_distance(b));
+}
+
+inline int ModeDetector::classify(const std::vector<Anchor>& anchors)
+{
+	if (anchors.size() < 4)
+		return 0;
+
+	// tl, tr, bl, br. Average opposite edges to take the edge off perspective
+	point<int> tl = anchors[0].center();
+	point<int> tr = anchors[1].center();
+	point<int> bl = anchors[2].center();
+	point<int> br = anchors[3].center();
+	double width = (edge(tl, tr) + edge(bl, br)) / 2;
+	double height = (edge(tl, bl) + edge(tr, br)) / 2;
+	if (width < 1 or height < 1)
+		return 0;
+
+	double ratio = std::log(width / height);
+	int best = 0;
+	double bestDistance = 0;
+	for (int mode_val : {68, 66, 67})
+	{
+		double distance = std::abs(ratio - std::log(expected_ratio(mode_val)));
+		if (!best or distance < bestDistance)
+		{
+			best = mode_val;
+			bestDistance = distance;
+		}
+	}
+	return best;
+}
+
+inline int ModeDetector::pick(const std::vector<Anchor>& anchors)
+{
+	int sticky = _sticky.load();
+	if (sticky)
+		return sticky;
+
+	int mode_val = classify(anchors);
+	if (mode_val == 68 and (_squareGuesses++ % 2))
+		return 4;
+	return mode_val;
+}
+
+inline void ModeDetector::report(int mode_val, bool success)
+{
+	if (success)
+	{
+		_failures = 0;
+		_sticky = mode_val;
+		return;
+	}
+
+	if (_sticky.load() != mode_val)
+		return;
+	if (++_failures >= _maxFailures)
+	{
+		_failures = 0;
+		_sticky = 0;
+	}
+}
+
+inline void ModeDetector::reset()
+{
+	_sticky = 0;
+	_failures = 0;
+}
+
+inline int ModeDetector::current() const
+{
+	return _sticky;
+}
@@ -3,46 +3,91 @@
 #include "compression/zstd_decompressor.h"
 #include "encoder/Decoder.h"
 #include "extractor/Anchor.h"
+#include "extractor/AnchorTracker.h"
+#include "extractor/DeskewCache.h"
 #include "extractor/Deskewer.h"
 #include "extractor/Extractor.h"
 #include "extractor/Scanner.h"
 #include "fountain/concurrent_fountain_decoder_sink.h"
+#include "util/stage_metrics.h"
 
+#include "FrameScheduler.h"
+#include "ModeDetector.h"
+#include "WorkerController.h"
+#include "concurrent/cpu_affinity.h"
+#include "concurrent/pipeline_stage.h"
 #include "concurrent/thread_pool.h"
 #include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <thread>
 
 class MultiThreadedDecoder
 {
 public:
 	MultiThreadedDecoder(std::string data_path, int mode_val);
-
-	inline static clock_t count = 0;
-	inline static clock_t bytes = 0;
-	inline static clock_t perfect = 0;
-	inline static clock_t decoded = 0;
-	inline static clock_t decodeTicks = 0;
-	inline static clock_t scanned = 0;
-	inline static clock_t scanTicks = 0;
-	inline static clock_t extractTicks = 0;
-
-	bool add(cv::Mat mat);
-
+	// joins every stage before any member goes away -- their jobs call back into _sched and _controller
+	~MultiThreadedDecoder();
+
+	// per-stage timings live in stage_metrics::global()
+	inline static std::atomic<uint64_t> count = 0;
+	inline static std::atomic<uint64_t> bytes = 0;
+	inline static std::atomic<uint64_t> perfect = 0;
+	inline static std::atomic<uint64_t> decoded = 0;
+	inline static std::atomic<uint64_t> scanned = 0;
+
+	// latest frame wins: if the workers are all busy, the frame replaces whatever was still waiting for one.
+	bool add(const cv::Mat& mat);
+
+	// waits for every frame we've accepted to make it through all three stages. add() refuses new ones from here on
+	void flush();
+	// flushes, then joins every stage
 	void stop();
 
 	int mode() const;
 	bool set_mode(int mode_val);
 	int detected_mode() const;
 
+	// total, across the extract, symbol and color stages
 	unsigned num_threads() const;
+	// extract workers the controller currently lets run
+	unsigned active_workers() const;
+	// frames we've accepted and not finished: waiting, being extracted, or in the symbol/color stages
 	unsigned backlog() const;
+	unsigned frames_waiting() const;
+	uint64_t frames_dropped() const;
+	uint64_t frames_replaced() const;
+	// frames whose anchors were found near where they were last time, vs with a full scan
+	uint64_t frames_tracked() const;
+	uint64_t full_scans() const;
+	// frames deskewed with the cached remap tables, vs with a fresh transform
+	uint64_t deskew_cache_hits() const;
+	uint64_t deskew_cache_misses() const;
+	histogram_snapshot queue_wait() const;
 	unsigned files_in_flight() const;
 	unsigned files_decoded() const;
 	std::vector<std::string> get_done() const;
 	std::vector<double> get_progress() const;
 
 protected:
-	int do_extract(const cv::Mat& mat, cv::Mat& img);
+	// a frame on its way through the pipeline: extract -> symbols (+RS) -> colors (+RS) -> the fountain sink
+	struct DecodeJob
+	{
+		cv::Mat img;
+		unsigned modeVal;
+		bool shouldPreprocess;
+		std::shared_ptr<Decoder::fountain_frame<concurrent_fountain_decoder_sink>> frame;
+		unsigned bytes;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	int do_extract(const cv::Mat& mat, cv::Mat& img, unsigned& modeVal);
+	void decode_frame(const cv::Mat& frame, unsigned modeVal);
+	void decode_symbols(DecodeJob& job);
+	void decode_colors(DecodeJob& job);
+	void finish(const DecodeJob& job);
+	void update_workers(bool anchors, unsigned decodeRes, std::chrono::steady_clock::time_point start);
 	void save(const cv::Mat& img);
 
 	static unsigned fountain_chunk_size(int mode_val);
@@ -50,94 +95,160 @@ protected:
 protected:
 	int _modeVal;
 	int _detectedMode;
+	ModeDetector _detector;
+	AnchorTracker _tracker;
+	DeskewCache _deskewCache;
 
 	Decoder _dec;
 	unsigned _numThreads;
-	turbo::thread_pool _pool;
 	concurrent_fountain_decoder_sink _writer;
 	std::string _dataPath;
 	unsigned _successCondition;
+	std::atomic<uint64_t> _backpressured;
+	std::atomic<bool> _stopping;
+	WorkerController _controller;
+
+	// downstream stages first, so each outlives whoever feeds it
+	turbo::pipeline_stage<DecodeJob> _colors;
+	turbo::pipeline_stage<DecodeJob> _symbols;
+	FrameScheduler _sched; // before _pool, so it outlives the workers
+	turbo::thread_pool _pool;
 };
 
 inline MultiThreadedDecoder::MultiThreadedDecoder(std::string data_path, int mode_val)
 	: _modeVal(mode_val)
 	, _detectedMode(0)
+	, _detector()
+	, _tracker()
+	, _deskewCache()
 	, _dec(cimbar::Config::ecc_bytes(), cimbar::Config::color_bits())
 	, _numThreads(std::max<int>(((int)std::thread::hardware_concurrency()/2), 1))
-	, _pool(_numThreads, 1)
 	, _writer(fountain_chunk_size(mode_val), decompress_on_store<std::ofstream>(data_path, true))
 	, _dataPath(data_path)
 	, _successCondition(cimbar::Config::temp_conf(mode_val).capacity() * .7)
+	, _backpressured(0)
+	, _stopping(false)
+	, _controller(1, (_numThreads+1)/2)
+	// scan+deskew is the long pole, so it gets half the threads. Each later stage can hold one frame beyond its workers.
+	, _colors(std::max<unsigned>(_numThreads/4, 1), std::max<unsigned>(_numThreads/4, 1) + 1, [this] (DecodeJob& job) { decode_colors(job); })
+	, _symbols(std::max<unsigned>(_numThreads/4, 1), std::max<unsigned>(_numThreads/4, 1) + 1, [this] (DecodeJob& job) { decode_symbols(job); })
+	, _sched(_pool, (_numThreads+1)/2, [this] (const cv::Mat& frame, unsigned modeVal) { decode_frame(frame, modeVal); })
+	, _pool((_numThreads+1)/2)
 {
 	FountainInit::init();
+
+	// keep decode work off the little cores, if there are any
+	std::vector<int> cpus = turbo::fast_cpus();
+	_colors.set_affinity(cpus);
+	_symbols.set_affinity(cpus);
+	_pool.set_affinity(cpus);
+
+	_sched.set_worker_limit(_controller.target());
+	_colors.start();
+	_symbols.start();
 	_pool.start();
 }
 
-inline int MultiThreadedDecoder::do_extract(const cv::Mat& mat, cv::Mat& img)
+// if modeVal is 0, it gets resolved from the anchors
+inline int MultiThreadedDecoder::do_extract(const cv::Mat& mat, cv::Mat& img, unsigned& modeVal)
 {
-	clock_t begin = clock();
-
-	Scanner scanner(mat);
-	std::vector<Anchor> anchors = scanner.scan();
+	std::vector<Anchor> anchors;
+	{
+		stage_timer t(stage_metrics::SCAN);
+		anchors = _tracker.scan(mat, [] (const cv::Mat& img) { return Scanner::scan_pyramid(img); });
+	}
 	++scanned;
-	scanTicks += (clock() - begin);
 
 	//if (anchors.size() >= 3) save(mat);
 
 	if (anchors.size() < 4)
 		return Extractor::FAILURE;
 
-	begin = clock();
+	if (modeVal == 0)
+		modeVal = _detector.pick(anchors);
+	cimbar::Config::update(modeVal);
+
+	stage_timer t(stage_metrics::DESKEW);
 	Corners corners(anchors);
-	Deskewer de;
-	img = de.deskew(mat, corners);
-	extractTicks += (clock() - begin);
+	img = _deskewCache.deskew(mat, corners);
 
 	return Extractor::SUCCESS;
 }
 
-inline bool MultiThreadedDecoder::add(cv::Mat mat)
-{
-    ++count;
-    unsigned modeVal = _modeVal;
-    if (modeVal == 0)
-    {
-        switch (count%4) {
-            case 1:
-                modeVal = 4;
-                break;
-            case 2:
-                modeVal = 66;
-                break;
-            case 3:
-                modeVal = 67;
-                break;
-            default:
-                modeVal = 68;
-        }
-    }
-    return _pool.try_execute( [&, mat, modeVal] () {
-		cimbar::Config::update(modeVal);
-		cv::Mat img;
-		int res = do_extract(mat, img);
-		if (res == Extractor::FAILURE)
-			return;
+inline bool MultiThreadedDecoder::add(const cv::Mat& mat)
+{
+	if (_stopping)
+		return false;
+	++count;
+	return _sched.post(mat, _modeVal);
+}
 
-		// if extracted image is small, we'll need to run some filters on it
-		clock_t begin = clock();
-		bool should_preprocess = (res == Extractor::NEEDS_SHARPEN);
-		int color_correction = modeVal==4? 1 : 2;
-		unsigned decodeRes = _dec.decode_fountain(img, _writer, should_preprocess, color_correction);
-		bytes += decodeRes;
-		++decoded;
-		decodeTicks += clock() - begin;
+inline void MultiThreadedDecoder::decode_frame(const cv::Mat& frame, unsigned modeVal)
+{
+	// if the next stage can't take another frame, don't bother scanning this one
+	if (_symbols.full())
+	{
+		++_backpressured;
+		return;
+	}
+
+	DecodeJob job;
+	job.start = std::chrono::steady_clock::now();
+	int res = do_extract(frame, job.img, modeVal);
+	if (res == Extractor::FAILURE)
+		return update_workers(false, 0, job.start);
+
+	// if extracted image is small, we'll need to run some filters on it
+	job.shouldPreprocess = (res == Extractor::NEEDS_SHARPEN);
+	job.modeVal = modeVal;
+	job.bytes = 0;
+	_symbols.push_or_run(job);
+}
 
-		if (decodeRes and _modeVal == 0)
-			_detectedMode = modeVal;
+inline void MultiThreadedDecoder::decode_symbols(DecodeJob& job)
+{
+	cimbar::Config::update(job.modeVal);
+	int color_correction = job.modeVal==4? 1 : 2;
+	job.frame = _dec.decode_fountain_symbols(job.img, _writer, job.bytes, job.shouldPreprocess, color_correction);
+	if (!job.frame)
+		return finish(job);
+
+	job.img = cv::Mat(); // the reader has its own reference
+	_colors.push_or_run(job);
+}
+
+inline void MultiThreadedDecoder::decode_colors(DecodeJob& job)
+{
+	cimbar::Config::update(job.modeVal);
+	job.bytes = _dec.decode_fountain_colors(*job.frame);
+	job.frame.reset();
+	finish(job);
+}
+
+inline void MultiThreadedDecoder::finish(const DecodeJob& job)
+{
+	unsigned decodeRes = job.bytes;
+	bytes += decodeRes;
+	++decoded;
+
+	if (_modeVal == 0)
+	{
+		_detector.report(job.modeVal, decodeRes > 0);
+		if (decodeRes)
+			_detectedMode = job.modeVal;
+	}
+
+	if (decodeRes >= _successCondition)
+		++perfect;
 
-		if (decodeRes >= _successCondition)
-			++perfect;
-	} );
+	update_workers(true, decodeRes, job.start);
+}
+
+inline void MultiThreadedDecoder::update_workers(bool anchors, unsigned decodeRes, std::chrono::steady_clock::time_point start)
+{
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	bool done = _writer.num_done() > 0 and _writer.num_streams() == 0;
+	_sched.set_worker_limit(_controller.record(anchors, decodeRes, micros, _sched.replaced(), done));
 }
 
 inline void MultiThreadedDecoder::save(const cv::Mat& mat)
@@ -149,12 +260,34 @@ inline void MultiThreadedDecoder::save(const cv::Mat& mat)
 	cv::imwrite(fname.str(), bgr);
 }
 
+inline MultiThreadedDecoder::~MultiThreadedDecoder()
+{
+	stop();
+}
+
+inline void MultiThreadedDecoder::flush()
+{
+	_stopping = true;
+
+	// upstream first: once a stage is done, nothing new can reach the next one.
+	// a frame is handed on before its worker lets go of it, so it's always counted somewhere.
+	while (!_sched.idle())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	_symbols.drain();
+	_colors.drain();
+}
+
 inline void MultiThreadedDecoder::stop()
 {
+	flush();
+
+	// upstream first
 	_pool.stop();
+	_symbols.stop();
+	_colors.stop();
 }
 
-unsigned MultiThreadedDecoder::fountain_chunk_size(int mode_val)
+inline unsigned MultiThreadedDecoder::fountain_chunk_size(int mode_val)
 {
 	return cimbar::Config::temp_conf(mode_val).fountain_chunk_size();
 }
@@ -174,7 +307,10 @@ inline bool MultiThreadedDecoder::set_mode(int mode_val)
 
 	// reset detectedMode iff we're switching back to autodetect
 	if (mode_val == 0)
+	{
 		_detectedMode = 0;
+		_detector.reset();
+	}
 
 	_modeVal = mode_val;
 	return true;
@@ -187,12 +323,62 @@ inline int MultiThreadedDecoder::detected_mode() const
 
 inline unsigned MultiThreadedDecoder::num_threads() const
 {
-	return _numThreads;
+	return (_numThreads+1)/2 + _symbols.num_threads() + _colors.num_threads();
+}
+
+inline unsigned MultiThreadedDecoder::active_workers() const
+{
+	return _sched.worker_limit();
 }
 
 inline unsigned MultiThreadedDecoder::backlog() const
 {
-	return _pool.queued();
+	return _sched.pending() + _sched.active_workers() + _symbols.in_flight() + _colors.in_flight();
+}
+
+// frames not yet picked up by an extract worker
+inline unsigned MultiThreadedDecoder::frames_waiting() const
+{
+	return _sched.pending();
+}
+
+inline uint64_t MultiThreadedDecoder::frames_dropped() const
+{
+	return _sched.dropped() + _backpressured;
+}
+
+inline uint64_t MultiThreadedDecoder::frames_replaced() const
+{
+	return _sched.replaced();
+}
+
+inline uint64_t MultiThreadedDecoder::frames_tracked() const
+{
+	return _tracker.tracked();
+}
+
+inline uint64_t MultiThreadedDecoder::full_scans() const
+{
+	return _tracker.full_scans();
+}
+
+inline uint64_t MultiThreadedDecoder::deskew_cache_hits() const
+{
+	return _deskewCache.hits();
+}
+
+inline uint64_t MultiThreadedDecoder::deskew_cache_misses() const
+{
+	return _deskewCache.misses();
+}
+
+// across all three stages, in microseconds
+inline histogram_snapshot MultiThreadedDecoder::queue_wait() const
+{
+	histogram_snapshot snap = _pool.queue_wait();
+	snap.merge(_symbols.queue_wait());
+	snap.merge(_colors.queue_wait());
+	return snap;
 }
 
 inline unsigned MultiThreadedDecoder::files_in_flight() const
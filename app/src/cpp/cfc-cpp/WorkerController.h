@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// how many extract workers should be active, judged one window of frames at a time.
+// * nothing to do (every file is done, or no frame in the window had anchors) -> drop to the minimum.
+// * frames are piling up (the scheduler replaced some) and they're decoding -> add a worker,
+//   unless frame latency got a lot worse the last time we did that. Then we're past what the cores can give us: back off.
+// * frames aren't piling up, and few of them decode -> shed a worker.
+class WorkerController
+{
+public:
+	WorkerController(unsigned min_workers, unsigned max_workers, unsigned window=16);
+
+	// once per frame. `replaced` is the scheduler's running count, `done` is whether every file we've seen is finished.
+	// returns the target worker count.
+	unsigned record(bool anchors, unsigned bytes, uint64_t micros, uint64_t replaced, bool done);
+
+	unsigned target() const;
+
+protected:
+	unsigned decide(uint64_t replaced, bool done);
+
+protected:
+	unsigned _minWorkers;
+	unsigned _maxWorkers;
+	unsigned _window;
+	std::atomic<unsigned> _target;
+
+	std::mutex _mutex;
+	unsigned _frames = 0;
+	unsigned _withAnchors = 0;
+	unsigned _useful = 0;
+	uint64_t _totalMicros = 0;
+	uint64_t _lastReplaced = 0;
+	double _latencyBeforeGrowth = 0;
+};
+
+inline WorkerController::WorkerController(unsigned min_workers, unsigned max_workers, unsigned window)
+	: _minWorkers(std::max(min_workers, 1U))
+	, _maxWorkers(std::max(max_workers, _minWorkers))
+	, _window(window)
+	, _target((_minWorkers + _maxWorkers + 1) / 2)
+{
+}
+
+inline unsigned WorkerController::record(bool anchors, unsigned bytes, uint64_t micros, uint64_t replaced, bool done)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	++_frames;
+	_withAnchors += anchors;
+	_useful += (bytes > 0);
+	_totalMicros += micros;
+	if (_frames < _window)
+		return _target;
+
+	_target = decide(replaced, done);
+	_frames = _withAnchors = _useful = 0;
+	_totalMicros = 0;
+	_lastReplaced = replaced;
+	return _target;
+}
+
+inline unsigned WorkerController::decide(uint64_t replaced, bool done)
+{
+	unsigned target = _target;
+	if (done or _withAnchors == 0)
+		return _minWorkers;
+
+	double latency = _totalMicros * 1.0 / _frames;
+	bool backlogged = replaced > _lastReplaced;
+	bool decoding = _useful * 2 >= _withAnchors;
+
+	if (_latencyBeforeGrowth > 0 and latency > _latencyBeforeGrowth * 1.5)
+	{
+		// the last worker we added slowed everyone down
+		_latencyBeforeGrowth = 0;
+		return std::max(target - 1, _minWorkers);
+	}
+
+	if (backlogged and decoding)
+	{
+		if (target >= _maxWorkers)
+			return target;
+		_latencyBeforeGrowth = latency;
+		return target + 1;
+	}
+
+	if (!backlogged and _useful * 4 < _withAnchors)
+		return std::max(target - 1, _minWorkers);
+	return target;
+}
+
+inline unsigned WorkerController::target() const
+{
+	return _target;
+}
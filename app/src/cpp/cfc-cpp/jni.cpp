@@ -26,14 +26,12 @@ namespace {
 
 	unsigned _calls = 0;
 	int _transferStatus = 0;
-	clock_t _frameDecodeSnapshot = 0;
-	clock_t _frameSuccessSnapshot = 0;
+	uint64_t _frameDecodeSnapshot = 0;
+	uint64_t _frameSuccessSnapshot = 0;
 
-	unsigned millis(unsigned num, unsigned denom)
+	unsigned millis(uint64_t micros)
 	{
-		if (!denom)
-			denom = 1;
-		return (num / denom) * 1000 / CLOCKS_PER_SEC;
+		return micros / 1000;
 	}
 
 	unsigned percent(unsigned num, unsigned denom)
@@ -124,14 +122,20 @@ namespace {
 	void drawDebugInfo(cv::Mat& mat, MultiThreadedDecoder& proc)
 	{
 		std::stringstream sstop;
-		sstop << "cfc using " << proc.num_threads() << " thread(s). " << proc.mode() << ":" << proc.detected_mode() << "..." << proc.backlog() << "? ";
+		sstop << "cfc using " << proc.active_workers() << "/" << proc.num_threads() << " thread(s). " << proc.mode() << ":" << proc.detected_mode() << "..." << proc.backlog() << "? ";
 		sstop << (MultiThreadedDecoder::bytes / std::max<double>(1, MultiThreadedDecoder::decoded)) << "b v0.6.4";
 		std::stringstream ssmid;
 		ssmid << "#: " << MultiThreadedDecoder::perfect << " / " << MultiThreadedDecoder::decoded << " / " << MultiThreadedDecoder::scanned << " / " << _calls;
+		ssmid << " (-" << proc.frames_replaced() << ")";
+		// p50/p99, in ms
+		stage_metrics::snapshot_t timings = stage_metrics::global().snapshot();
 		std::stringstream ssperf;
-		ssperf << "scan: " << millis(MultiThreadedDecoder::scanTicks, MultiThreadedDecoder::scanned);
-		ssperf << ", extract: " << millis(MultiThreadedDecoder::extractTicks, MultiThreadedDecoder::decoded);
-		ssperf << ", decode: " << millis(MultiThreadedDecoder::decodeTicks, MultiThreadedDecoder::decoded);
+		for (unsigned s : {stage_metrics::SCAN, stage_metrics::DESKEW, stage_metrics::SYMBOL_DECODE, stage_metrics::COLOR_DECODE})
+		{
+			if (s != stage_metrics::SCAN)
+				ssperf << ", ";
+			ssperf << stage_metrics::stage_name(s) << ": " << millis(timings[s].percentile(.5)) << "/" << millis(timings[s].percentile(.99));
+		}
 		std::stringstream sstats;
 		sstats << "Files received: " << proc.files_decoded() << ", in flight: " << proc.files_in_flight() << ". ";
 		sstats << percent(MultiThreadedDecoder::perfect, MultiThreadedDecoder::decoded) << "% decode. ";
@@ -143,11 +147,8 @@ namespace {
 		cv::putText(mat, sstats.str(), cv::Point(5,200), cv::FONT_HERSHEY_DUPLEX, 1, cv::Scalar(255,255,80), 2);
 
 		/*std::stringstream ssperf2;
-		ssperf2 << "reader ctor: " << millis(Decoder::readerInitTicks, MultiThreadedDecoder::decoded);
-		ssperf2 << ", fount: " << millis(Decoder::fountTicks, MultiThreadedDecoder::decoded);
-		ssperf2 << ", dodecode: " << millis(Decoder::decodeTicks, MultiThreadedDecoder::decoded);
-		ssperf2 << ", readloop: " << millis(Decoder::bbTicks, MultiThreadedDecoder::decoded);
-		ssperf2 << ", rss: " << millis(Decoder::rssTicks, MultiThreadedDecoder::decoded);
+		for (unsigned s : {stage_metrics::REED_SOLOMON, stage_metrics::FOUNTAIN_INGEST, stage_metrics::STORE})
+			ssperf2 << stage_metrics::stage_name(s) << ": " << millis(timings[s].percentile(.5)) << "/" << millis(timings[s].percentile(.99)) << " ";
 		cv::putText(mat, ssperf2.str(), cv::Point(5,300), cv::FONT_HERSHEY_DUPLEX, 1, cv::Scalar(255,255,80), 2);
 		//*/
 	}
@@ -181,13 +182,12 @@ Java_org_cimbar_camerafilecopy_MainActivity_processImageJNI(JNIEnv *env, jobject
 	}
 
 	clock_t begin = clock();
-	cv::Mat img = mat.clone();
-	proc->add(img);
+	proc->add(mat);
 
 	if (_calls & 31)
 	{
-		clock_t decodeSnapshot = proc->decoded;
-		clock_t perfectSnapshot = proc->perfect;
+		uint64_t decodeSnapshot = proc->decoded;
+		uint64_t perfectSnapshot = proc->perfect;
 		_transferStatus = perfectSnapshot > _frameSuccessSnapshot; // a bit silly, but 1 == partial decode
 		_transferStatus += (decodeSnapshot > _frameDecodeSnapshot); // 2 == full decode
 		_frameDecodeSnapshot = decodeSnapshot;
@@ -0,0 +1,267 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "cfc-cpp/MultiThreadedDecoder.h"
+
+#include "cxxopts/cxxopts.hpp"
+#include "util/MakeTempDirectory.h"
+#include "util/stage_metrics.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace {
+	using clock_type = std::chrono::steady_clock;
+
+	struct ReplayOptions
+	{
+		double fps = 0;
+		unsigned loops = 1;
+		int width = 0;
+		int height = 0;
+		string outpath;
+	};
+
+	struct CounterSnapshot
+	{
+		uint64_t count = MultiThreadedDecoder::count;
+		uint64_t bytes = MultiThreadedDecoder::bytes;
+		uint64_t perfect = MultiThreadedDecoder::perfect;
+		uint64_t decoded = MultiThreadedDecoder::decoded;
+		uint64_t scanned = MultiThreadedDecoder::scanned;
+	};
+
+	double millis(double micros)
+	{
+		return micros / 1000.0;
+	}
+
+	double elapsed_ms(clock_type::time_point start, clock_type::time_point end=clock_type::now())
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	template <typename T>
+	T percentile(vector<T> samples, double p)
+	{
+		if (samples.empty())
+			return T();
+		unsigned idx = std::min<unsigned>(samples.size() - 1, samples.size() * p);
+		std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+		return samples[idx];
+	}
+
+	int parse_mode(const string& mode)
+	{
+		if (mode == "4" or mode == "4c" or mode == "4C")
+			return 4;
+		else if (mode == "Bu" or mode == "BU")
+			return 66;
+		else if (mode == "Bm" or mode == "BM")
+			return 67;
+		else if (mode == "B")
+			return 68;
+		else if (mode == "auto" or mode == "0")
+			return 0;
+		return -1;
+	}
+
+	// frames are handed to the decoder as RGBA, the same as processImageJNI sees them on the phone
+	cv::Mat load_frame(const std::filesystem::path& path, const ReplayOptions& opts)
+	{
+		string ext = path.extension().string();
+		if (ext == ".rgba" or ext == ".nv21")
+		{
+			if (opts.width <= 0 or opts.height <= 0)
+				return cv::Mat();
+
+			std::ifstream f(path, std::ios::binary);
+			bool rgba = (ext == ".rgba");
+			cv::Mat raw(rgba? opts.height : opts.height*3/2, opts.width, rgba? CV_8UC4 : CV_8UC1);
+			if (!f.read(reinterpret_cast<char*>(raw.data), raw.total() * raw.elemSize()))
+				return cv::Mat();
+			if (rgba)
+				return raw;
+
+			cv::Mat img;
+			cv::cvtColor(raw, img, cv::COLOR_YUV2RGBA_NV21);
+			return img;
+		}
+
+		cv::Mat img = cv::imread(path.string());
+		if (img.empty())
+			return img;
+		cv::cvtColor(img, img, cv::COLOR_BGR2RGBA);
+		return img;
+	}
+
+	vector<cv::Mat> load_frames(const string& dir, const ReplayOptions& opts)
+	{
+		vector<std::filesystem::path> paths;
+		for (const auto& entry : std::filesystem::directory_iterator(dir))
+			if (entry.is_regular_file())
+				paths.push_back(entry.path());
+		std::sort(paths.begin(), paths.end());
+
+		vector<cv::Mat> frames;
+		for (const auto& p : paths)
+		{
+			cv::Mat img = load_frame(p, opts);
+			if (img.empty())
+				std::cerr << "skipping " << p.string() << std::endl;
+			else
+				frames.push_back(img);
+		}
+		return frames;
+	}
+
+	void replay(const string& modeName, int modeVal, const vector<cv::Mat>& frames, const ReplayOptions& opts)
+	{
+		MakeTempDirectory tempdir;
+		string outpath = opts.outpath.empty()? tempdir.path().string() : opts.outpath;
+
+		// the previous run's decoder has been stopped, so nothing is recording
+		stage_metrics::global().reset();
+		CounterSnapshot before;
+		MultiThreadedDecoder proc(outpath, modeVal);
+
+		unsigned accepted = 0;
+		unsigned rejected = 0;
+		vector<unsigned> backlog;
+		double firstFileMs = -1;
+
+		clock_type::duration interval = clock_type::duration::zero();
+		if (opts.fps > 0)
+			interval = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / opts.fps));
+
+		clock_type::time_point start = clock_type::now();
+		clock_type::time_point next = start;
+		for (unsigned loop = 0; loop < opts.loops and firstFileMs < 0; ++loop)
+			for (const cv::Mat& frame : frames)
+			{
+				if (opts.fps > 0)
+				{
+					std::this_thread::sleep_until(next);
+					next += interval;
+					if (proc.add(frame))
+						++accepted;
+					else
+						++rejected;
+				}
+				else
+				{
+					// as fast as possible: hand over the next frame as soon as the last one has been picked up, so none are replaced
+					while (proc.frames_waiting() > 0)
+						std::this_thread::yield();
+					while (!proc.add(frame))
+						std::this_thread::yield();
+					++accepted;
+				}
+				backlog.push_back(proc.backlog());
+
+				if (firstFileMs < 0 and proc.files_decoded() > 0)
+				{
+					firstFileMs = elapsed_ms(start);
+					break;
+				}
+			}
+
+		// every accepted frame all the way through, so the counts (and the time) include the last ones
+		proc.flush();
+		double totalMs = elapsed_ms(start);
+		proc.stop();
+		if (firstFileMs < 0 and proc.files_decoded() > 0)
+			firstFileMs = totalMs;
+
+		CounterSnapshot after;
+		uint64_t scanned = after.scanned - before.scanned;
+		uint64_t decoded = after.decoded - before.decoded;
+
+		std::cout << "mode " << modeName << " (" << modeVal << "), " << proc.num_threads() << " thread(s), "
+				  << proc.active_workers() << " extract worker(s) active at the end" << std::endl;
+		std::cout << "  frames: " << (accepted + rejected) << " offered, " << accepted << " accepted, " << proc.frames_replaced() << " replaced, "
+				  << proc.frames_dropped() << " dropped" << std::endl;
+		std::cout << "  throughput: " << (accepted * 1000.0 / std::max(totalMs, 1.0)) << " fps over " << totalMs << "ms" << std::endl;
+		std::cout << "  backlog: p50=" << percentile(backlog, .5) << " p90=" << percentile(backlog, .9)
+				  << " max=" << (backlog.empty()? 0 : *std::max_element(backlog.begin(), backlog.end())) << std::endl;
+		std::cout << "  anchors: " << proc.frames_tracked() << " tracked, " << proc.full_scans() << " full scans" << std::endl;
+		std::cout << "  deskew: " << proc.deskew_cache_hits() << " from cached maps, " << proc.deskew_cache_misses() << " from scratch" << std::endl;
+		std::cout << "  scanned: " << scanned << ", decoded: " << decoded << ", perfect: " << (after.perfect - before.perfect)
+				  << ", bytes/decode: " << ((after.bytes - before.bytes) / std::max<double>(1, decoded)) << std::endl;
+		stage_metrics::snapshot_t timings = stage_metrics::global().snapshot();
+		for (unsigned s = 0; s < stage_metrics::NUM_STAGES; ++s)
+		{
+			const histogram_snapshot& h = timings[s];
+			std::cout << "  " << stage_metrics::stage_name(s) << " ms: n=" << h.count() << " avg=" << millis(h.avg())
+					  << " p50=" << millis(h.percentile(.5)) << " p90=" << millis(h.percentile(.9))
+					  << " p99=" << millis(h.percentile(.99)) << " max=" << millis(h.max()) << std::endl;
+		}
+		histogram_snapshot wait = proc.queue_wait();
+		std::cout << "  queue wait ms: n=" << wait.count() << " avg=" << millis(wait.avg())
+				  << " p50=" << millis(wait.percentile(.5)) << " p99=" << millis(wait.percentile(.99)) << " max=" << millis(wait.max()) << std::endl;
+		if (firstFileMs >= 0)
+			std::cout << "  time to complete file: " << firstFileMs << "ms (" << proc.files_decoded() << " file(s))" << std::endl;
+		else
+			std::cout << "  time to complete file: incomplete, " << proc.files_in_flight() << " file(s) in flight" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cxxopts::Options options("cfc-replay", "Replay recorded camera frames through the cfc decoder");
+	options.add_options()
+		("i,in", "Directory of recorded frames. png/jpg, or raw .rgba/.nv21 dumps (needs --width and --height)", cxxopts::value<string>())
+		("m,mode", "Modes to replay, each with a fresh decoder. [4C,B,Bm,Bu,auto]", cxxopts::value<vector<string>>()->default_value("B"))
+		("fps", "Rate to offer frames at. A frame still waiting for a worker is replaced by the next one. 0 == as fast as possible.", cxxopts::value<double>()->default_value("30"))
+		("loops", "Max passes over the frame directory, if the file hasn't completed yet.", cxxopts::value<unsigned>()->default_value("1"))
+		("width", "Frame width, for raw dumps.", cxxopts::value<int>()->default_value("0"))
+		("height", "Frame height, for raw dumps.", cxxopts::value<int>()->default_value("0"))
+		("o,out", "Output directory for decoded files. Defaults to a temp directory.", cxxopts::value<string>())
+		("h,help", "Print usage")
+	;
+	options.show_positional_help();
+	options.parse_positional({"in"});
+	options.positional_help("<in>");
+
+	auto result = options.parse(argc, argv);
+	if (result.count("help") or !result.count("in"))
+	{
+		std::cerr << options.help() << std::endl;
+		return 0;
+	}
+
+	ReplayOptions opts;
+	opts.fps = result["fps"].as<double>();
+	opts.loops = std::max(1u, result["loops"].as<unsigned>());
+	opts.width = result["width"].as<int>();
+	opts.height = result["height"].as<int>();
+	if (result.count("out"))
+		opts.outpath = result["out"].as<string>();
+
+	vector<cv::Mat> frames = load_frames(result["in"].as<string>(), opts);
+	if (frames.empty())
+	{
+		std::cerr << "No frames? :(" << std::endl;
+		return 128;
+	}
+	std::cout << "loaded " << frames.size() << " frame(s)" << std::endl;
+
+	for (const string& modeName : result["mode"].as<vector<string>>())
+	{
+		int modeVal = parse_mode(modeName);
+		if (modeVal < 0)
+		{
+			std::cerr << "unknown mode " << modeName << std::endl;
+			return 1;
+		}
+		replay(modeName, modeVal, frames, opts);
+	}
+	return 0;
+}
@@ -0,0 +1,41 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace turbo {
+
+// the cpus within 75% of the highest max frequency -- i.e. the big (and prime) cores, on a big.LITTLE phone.
+// empty if we can't tell, or if every core qualifies. (in which case there's no reason to pin anything)
+inline std::vector<int> fast_cpus()
+{
+	unsigned numCpus = std::thread::hardware_concurrency();
+	std::vector<long> freqs;
+	for (unsigned i = 0; i < numCpus; ++i)
+	{
+		std::ifstream f("/sys/devices/system/cpu/cpu" + std::to_string(i) + "/cpufreq/cpuinfo_max_freq");
+		long freq = 0;
+		if (!(f >> freq))
+			return {};
+		freqs.push_back(freq);
+	}
+
+	long best = 0;
+	for (long freq : freqs)
+		best = std::max(best, freq);
+
+	std::vector<int> cpus;
+	for (unsigned i = 0; i < freqs.size(); ++i)
+		if (freqs[i] * 4 >= best * 3)
+			cpus.push_back(i);
+
+	if (cpus.size() == freqs.size())
+		return {};
+	return cpus;
+}
+
+} // namespace turbo
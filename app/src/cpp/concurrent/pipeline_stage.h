@@ -0,0 +1,143 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace turbo {
+
+// a pipeline stage: its own workers, and a bounded number of items queued or in progress.
+// when the stage is full, try_push() fails, and push_or_run() runs the item on the caller's thread --
+// which stalls the upstream stage, and so on back to the source. That's our backpressure.
+template <typename T>
+class pipeline_stage
+{
+public:
+	pipeline_stage(unsigned numThreads, unsigned capacity, const std::function<void(T&)>& fun);
+	~pipeline_stage();
+
+	void set_affinity(const std::vector<int>& cpus);
+	bool start();
+	// waits for everything pushed so far to finish. stop() drops whatever is still queued, so drain first --
+	// once nothing upstream can push any more.
+	void drain() const;
+	void stop();
+
+	bool full() const;
+	bool try_push(T item);
+	void push_or_run(T item);
+
+	unsigned in_flight() const;
+	unsigned num_threads() const;
+	histogram_snapshot queue_wait() const;
+
+protected:
+	void run(T& item);
+
+protected:
+	unsigned _numThreads;
+	unsigned _capacity;
+	std::function<void(T&)> _fun;
+	std::atomic<unsigned> _inFlight;
+	thread_pool _pool;
+};
+
+template <typename T>
+inline pipeline_stage<T>::pipeline_stage(unsigned numThreads, unsigned capacity, const std::function<void(T&)>& fun)
+	: _numThreads(numThreads)
+	, _capacity(capacity)
+	, _fun(fun)
+	, _inFlight(0)
+	, _pool(numThreads)
+{
+}
+
+template <typename T>
+inline pipeline_stage<T>::~pipeline_stage()
+{
+	stop();
+}
+
+template <typename T>
+inline void pipeline_stage<T>::set_affinity(const std::vector<int>& cpus)
+{
+	_pool.set_affinity(cpus);
+}
+
+template <typename T>
+inline bool pipeline_stage<T>::start()
+{
+	return _pool.start();
+}
+
+template <typename T>
+inline void pipeline_stage<T>::drain() const
+{
+	while (_inFlight.load() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+template <typename T>
+inline void pipeline_stage<T>::stop()
+{
+	_pool.stop();
+}
+
+template <typename T>
+inline bool pipeline_stage<T>::full() const
+{
+	return _inFlight.load() >= _capacity;
+}
+
+template <typename T>
+inline bool pipeline_stage<T>::try_push(T item)
+{
+	unsigned inFlight = _inFlight.load();
+	do {
+		if (inFlight >= _capacity)
+			return false;
+	} while (!_inFlight.compare_exchange_weak(inFlight, inFlight+1));
+
+	_pool.execute( [this, item] () mutable {
+		run(item);
+		--_inFlight;
+	} );
+	return true;
+}
+
+template <typename T>
+inline void pipeline_stage<T>::push_or_run(T item)
+{
+	if (!try_push(item))
+		run(item);
+}
+
+template <typename T>
+inline void pipeline_stage<T>::run(T& item)
+{
+	_fun(item);
+}
+
+template <typename T>
+inline unsigned pipeline_stage<T>::in_flight() const
+{
+	return _inFlight;
+}
+
+template <typename T>
+inline unsigned pipeline_stage<T>::num_threads() const
+{
+	return _numThreads;
+}
+
+template <typename T>
+inline histogram_snapshot pipeline_stage<T>::queue_wait() const
+{
+	return _pool.queue_wait();
+}
+
+} // namespace turbo
@@ -2,13 +2,27 @@
 #pragma once
 
 #include "monitor.h"
-#include "concurrentqueue/concurrentqueue.h"
+#include "util/latency_histogram.h"
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 namespace turbo {
+
+// each worker has its own deque. Tasks submitted from a worker stay on it, others are dealt out round-robin.
+// an idle worker steals from the back of its neighbors' deques before it sleeps.
 class thread_pool
 {
 public:
@@ -16,6 +30,9 @@ public:
 	thread_pool(unsigned numThreads, unsigned producerLimit); // tries to limit size of queue
 	~thread_pool();
 
+	// call before start(). Workers pin themselves to these cpus, where the platform supports it.
+	void set_affinity(const std::vector<int>& cpus);
+
 	bool start();
 	void stop();
 
@@ -23,30 +40,63 @@ public:
 	bool try_execute(std::function<void()> fun);
 	size_t queued() const;
 
+	// how long tasks sat in a deque before a worker picked them up. Microseconds.
+	histogram_snapshot queue_wait() const;
+
 protected:
-	void run();
+	struct task
+	{
+		std::function<void()> fun;
+		std::chrono::steady_clock::time_point queuedAt;
+	};
+
+	struct worker
+	{
+		std::mutex mutex;
+		std::deque<task> tasks;
+		latency_histogram wait; // only written by this worker's thread
+	};
+
+	void run(unsigned id);
+	void push(std::function<void()>&& fun);
+	bool pop(unsigned id, task& t);
+	void pin_current_thread() const;
+
+	static const thread_pool*& current_pool();
+	static unsigned& current_worker();
 
 protected:
 	std::atomic<int> _running;
 	unsigned _numThreads;
+	unsigned _producerLimit;
 	std::list<std::thread> _threads;
+	std::vector<int> _cpus;
+
+	std::vector<std::unique_ptr<worker>> _workers;
+	std::atomic<int> _pending; // may dip below 0 for a moment, if a task is popped before push() counts it
+	std::atomic<unsigned> _nextWorker;
 
+	// _pending is re-checked under this mutex before a worker sleeps, and push() takes it before notifying.
+	// so a wakeup can't slip in between the check and the wait.
+	std::mutex _sleepMutex;
+	std::condition_variable _wake;
 	turbo::monitor _notifyRunning;
-	turbo::monitor _notifyWork;
-	moodycamel::ConcurrentQueue< std::function<void()> > _queue;
 };
 
 inline thread_pool::thread_pool(unsigned numThreads)
-    : _running(0)
-    , _numThreads(numThreads)
-    , _queue()
+	: thread_pool(numThreads, 0)
 {
 }
+
 inline thread_pool::thread_pool(unsigned numThreads, unsigned producerLimit)
-    : _running(0)
-    , _numThreads(numThreads)
-    , _queue(1, 0, producerLimit)
+	: _running(0)
+	, _numThreads(std::max(numThreads, 1U))
+	, _producerLimit(producerLimit)
+	, _pending(0)
+	, _nextWorker(0)
 {
+	for (unsigned i = 0; i < _numThreads; ++i)
+		_workers.push_back(std::make_unique<worker>());
 }
 
 inline thread_pool::~thread_pool()
@@ -54,21 +104,30 @@ inline thread_pool::~thread_pool()
 	stop();
 }
 
+inline void thread_pool::set_affinity(const std::vector<int>& cpus)
+{
+	_cpus = cpus;
+}
+
 inline bool thread_pool::start()
 {
 	if (_running > 0)
 		return true;
 
 	for (unsigned i = 0; i < _numThreads; ++i)
-		_threads.push_back( std::thread(std::bind(&thread_pool::run, this)) );
+		_threads.push_back( std::thread(std::bind(&thread_pool::run, this, i)) );
 	_notifyRunning.wait_for(10000);
-	return _running == _numThreads;
+	return _running == (int)_numThreads;
 }
 
 inline void thread_pool::stop()
 {
 	_running = -1 - _numThreads;
-	_notifyWork.signal_all();
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+	}
+	_wake.notify_all();
+
 	for (std::list<std::thread>::iterator it = _threads.begin(); it != _threads.end(); ++it)
 	{
 		if (it->joinable())
@@ -79,41 +138,126 @@ inline void thread_pool::stop()
 
 inline void thread_pool::execute(std::function<void()> fun)
 {
-	_queue.enqueue(fun);
-	_notifyWork.notify_one();
+	push(std::move(fun));
 }
 
 inline bool thread_pool::try_execute(std::function<void()> fun)
 {
-	bool success = _queue.try_enqueue(fun);
-	if (success)
-		_notifyWork.notify_one();
-	return success;
+	if (_producerLimit and _pending.load() >= (int)_producerLimit)
+		return false;
+	push(std::move(fun));
+	return true;
 }
 
 inline size_t thread_pool::queued() const
 {
-	return _queue.size_approx();
+	return std::max(_pending.load(), 0);
+}
+
+inline histogram_snapshot thread_pool::queue_wait() const
+{
+	histogram_snapshot snap;
+	for (const std::unique_ptr<worker>& w : _workers)
+		snap.merge(w->wait.snapshot());
+	return snap;
+}
+
+inline const thread_pool*& thread_pool::current_pool()
+{
+	static thread_local const thread_pool* pool = nullptr;
+	return pool;
+}
+
+inline unsigned& thread_pool::current_worker()
+{
+	static thread_local unsigned id = 0;
+	return id;
 }
 
-inline void thread_pool::run()
+inline void thread_pool::push(std::function<void()>&& fun)
 {
-	if (++_running == _numThreads)
+	// keep work submitted by one of our own tasks on the same core
+	unsigned id = (current_pool() == this)? current_worker() : (_nextWorker++ % _numThreads);
+	{
+		worker& w = *_workers[id];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.tasks.push_back({std::move(fun), std::chrono::steady_clock::now()});
+	}
+	++_pending;
+
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+	}
+	_wake.notify_one();
+}
+
+inline bool thread_pool::pop(unsigned id, task& t)
+{
+	{
+		worker& w = *_workers[id];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		if (!w.tasks.empty())
+		{
+			t = std::move(w.tasks.front());
+			w.tasks.pop_front();
+			--_pending;
+			return true;
+		}
+	}
+
+	for (unsigned i = 1; i < _numThreads; ++i)
+	{
+		worker& victim = *_workers[(id + i) % _numThreads];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.tasks.empty())
+			continue;
+		t = std::move(victim.tasks.back());
+		victim.tasks.pop_back();
+		--_pending;
+		return true;
+	}
+	return false;
+}
+
+inline void thread_pool::pin_current_thread() const
+{
+#ifdef __linux__
+	if (_cpus.empty())
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : _cpus)
+		CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set); // best effort
+#endif
+}
+
+inline void thread_pool::run(unsigned id)
+{
+	current_pool() = this;
+	current_worker() = id;
+	pin_current_thread();
+
+	if (++_running == (int)_numThreads)
 		_notifyRunning.signal_all();
+
+	worker& self = *_workers[id];
+	task t;
 	while (_running > 0)
 	{
-		_notifyWork.wait();
-		if (_running <= 0)
-			break;
-
-		std::function<void()> fun;
-		while (_queue.try_dequeue(fun))
+		if (pop(id, t))
 		{
-			if (_running <= 0)
-				break;
-			fun();
+			self.wait.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t.queuedAt).count());
+			t.fun();
+			t.fun = nullptr;
+			continue;
 		}
+
+		std::unique_lock<std::mutex> lock(_sleepMutex);
+		_wake.wait(lock, [this] () { return _pending.load() > 0 or _running <= 0; });
 	}
+	current_pool() = nullptr;
 }
 
 } // namespace turbo
@@ -9,6 +9,7 @@
 #include "fountain/FountainInit.h"
 #include "fountain/fountain_decoder_sink.h"
 #include "serialize/str.h"
+#include "util/worker_pool.h"
 
 #include "cxxopts/cxxopts.hpp"
 
@@ -124,6 +125,10 @@ template <typename FilenameIterable>
 int decode(const FilenameIterable& infiles, const std::function<int(cv::UMat, bool, int)>& decodefun, bool no_deskew, bool undistort, int preprocess, int color_correct)
 {
 	int err = 0;
+	// one for the whole run, so the distortion estimate and the composed undistort+deskew map carry over between frames.
+	// a different frame size is (probably) a different camera, so that starts over
+	Undistort<SimpleCameraCalibration> und;
+	cv::Size undistortSize;
 	for (const string& inf : infiles)
 	{
 		if (inf.empty())
@@ -136,15 +141,22 @@ int decode(const FilenameIterable& infiles, const std::function<int(cv::UMat, bo
 		{
 			// attempt undistort. It's currently a low-effort attempt to *reduce* distortion, not eliminate it.
 			// we rely on the decoder to power through minor distortion
+			// (the undistort is folded into the deskew, so the frame only gets resampled once)
+			Extractor ext;
+			int res;
 			if (undistort)
 			{
-				Undistort<SimpleCameraCalibration> und;
-				if (!und.undistort(img, img))
+				if (img.size() != undistortSize)
+				{
+					und.reset_distortion_params();
+					undistortSize = img.size();
+				}
+				res = ext.extract_undistorted(img, img, und);
+				if (!und)
 					err |= 1;
 			}
-
-			Extractor ext;
-			int res = ext.extract(img, img);
+			else
+				res = ext.extract(img, img);
 			if (!res)
 			{
 				err |= 2;
@@ -188,6 +200,7 @@ int main(int argc, char** argv)
 		("no-fountain", "Disable fountain encode/decode. Will also disable compression.", cxxopts::value<bool>())
 		("undistort", "Attempt undistort step -- useful if image distortion is significant.", cxxopts::value<bool>())
 		("preprocess", "Run sharpen filter on the input image. 1 == on. 0 == off. -1 == guess.", cxxopts::value<int>()->default_value("-1"))
+		("threads", "Decode each image's symbols on this many threads.", cxxopts::value<unsigned>()->default_value("1"))
 		("h,help", "Print usage")
 	;
 	options.show_positional_help();
@@ -257,8 +270,12 @@ int main(int argc, char** argv)
 	if (result.count("color-correction-file"))
 		color_correction_file = result["color-correction-file"].as<string>();
 	int preprocess = result["preprocess"].as<int>();
+	unsigned threads = result["threads"].as<unsigned>();
 
-	DecoderPlus d;
+	// the calling thread reads too, so that's threads-1 helpers
+	worker_pool pool(threads > 1? threads-1 : 0);
+	CimbReader::executor execute = [&pool] (std::function<void()> fun) { pool.execute(std::move(fun)); };
+	DecoderPlus d(true, true, execute, threads > 1? threads-1 : 0);
 
 	if (no_fountain)
 	{
@@ -0,0 +1,95 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// a 1 bit per pixel image.
+// each row is padded out to a whole number of 64 bit words, msb first: pixel x is bit (63 - x%64) of word x/64.
+// so a left-to-right run of pixels is a run of leading bits, which count-leading-zeros can skip over.
+class bitplane
+{
+public:
+	bitplane(unsigned width=0, unsigned height=0)
+	{
+		resize(width, height);
+	}
+
+	// contents are zeroed
+	void resize(unsigned width, unsigned height)
+	{
+		_width = width;
+		_height = height;
+		_wordsPerRow = (width + 63) / 64;
+		_words.assign(_wordsPerRow * height, 0);
+	}
+
+	bool get(unsigned x, unsigned y) const
+	{
+		return (row(y)[x >> 6] >> (63 - (x & 63))) & 1;
+	}
+
+	void set(unsigned x, unsigned y, bool val=true)
+	{
+		uint64_t mask = 1ULL << (63 - (x & 63));
+		uint64_t& word = row(y)[x >> 6];
+		word = val? (word | mask) : (word & ~mask);
+	}
+
+	// how many pixels, starting at x, have the same value as x. Stops at xend.
+	unsigned run_length(unsigned x, unsigned y, unsigned xend) const
+	{
+		const uint64_t* words = row(y);
+		bool val = get(x, y);
+		unsigned start = x;
+		while (x < xend)
+		{
+			unsigned offset = x & 63;
+			// flip 1-runs into 0-runs, so the run is the leading zeros. Shifted-in bits don't count.
+			uint64_t word = (val? ~words[x >> 6] : words[x >> 6]) << offset;
+			unsigned avail = 64 - offset;
+			unsigned len = word? std::min<unsigned>(__builtin_clzll(word), avail) : avail;
+			x += len;
+			if (len < avail)
+				break;
+		}
+		return std::min(x, xend) - start;
+	}
+
+	uint64_t* row(unsigned y)
+	{
+		return _words.data() + (y * _wordsPerRow);
+	}
+
+	const uint64_t* row(unsigned y) const
+	{
+		return _words.data() + (y * _wordsPerRow);
+	}
+
+	unsigned words_per_row() const
+	{
+		return _wordsPerRow;
+	}
+
+	int width() const
+	{
+		return _width;
+	}
+
+	int height() const
+	{
+		return _height;
+	}
+
+	bool empty() const
+	{
+		return _words.empty();
+	}
+
+protected:
+	int _width;
+	int _height;
+	unsigned _wordsPerRow;
+	std::vector<uint64_t> _words;
+};
@@ -0,0 +1,87 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "bitplane.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+TEST_CASE( "bitplaneTest/testGetSet", "[unit]" )
+{
+	bitplane bp(100, 3);
+	assertEquals( 100, bp.width() );
+	assertEquals( 3, bp.height() );
+	assertEquals( 2, bp.words_per_row() );
+
+	bp.set(0, 0);
+	bp.set(63, 1);
+	bp.set(64, 1);
+	bp.set(99, 2);
+
+	assertTrue( bp.get(0, 0) );
+	assertFalse( bp.get(1, 0) );
+	assertFalse( bp.get(0, 1) );
+	assertTrue( bp.get(63, 1) );
+	assertTrue( bp.get(64, 1) );
+	assertTrue( bp.get(99, 2) );
+	assertFalse( bp.get(98, 2) );
+
+	bp.set(63, 1, false);
+	assertFalse( bp.get(63, 1) );
+	assertTrue( bp.get(64, 1) );
+}
+
+TEST_CASE( "bitplaneTest/testLayout", "[unit]" )
+{
+	// msb first, one row after another
+	bitplane bp(70, 2);
+	bp.set(0, 0);
+	bp.set(2, 0);
+	bp.set(64, 1);
+	bp.set(69, 1);
+
+	assertEquals( 0xA000000000000000ULL, bp.row(0)[0] );
+	assertEquals( 0, bp.row(0)[1] );
+	assertEquals( 0, bp.row(1)[0] );
+	assertEquals( 0x8400000000000000ULL, bp.row(1)[1] );
+}
+
+TEST_CASE( "bitplaneTest/testResize", "[unit]" )
+{
+	bitplane bp;
+	assertTrue( bp.empty() );
+
+	bp.resize(8, 8);
+	bp.set(7, 7);
+	bp.resize(8, 8);
+	assertFalse( bp.get(7, 7) );
+	assertFalse( bp.empty() );
+}
+
+TEST_CASE( "bitplaneTest/testRunLength", "[unit]" )
+{
+	bitplane bp(200, 1);
+	for (unsigned x = 10; x < 150; ++x)
+		bp.set(x, 0);
+
+	assertEquals( 10, bp.run_length(0, 0, 200) );
+	assertEquals( 140, bp.run_length(10, 0, 200) );
+	assertEquals( 77, bp.run_length(73, 0, 200) );
+	assertEquals( 50, bp.run_length(150, 0, 200) );
+
+	// capped at xend
+	assertEquals( 5, bp.run_length(10, 0, 15) );
+	assertEquals( 1, bp.run_length(199, 0, 200) );
+}
+
+TEST_CASE( "bitplaneTest/testRunLengthToEdge", "[unit]" )
+{
+	// the padding bits past the width shouldn't bleed into a run
+	bitplane bp(70, 2);
+	for (unsigned x = 60; x < 70; ++x)
+		bp.set(x, 1);
+
+	assertEquals( 70, bp.run_length(0, 0, 70) );
+	assertEquals( 10, bp.run_length(60, 1, 70) );
+	assertEquals( 4, bp.run_length(66, 1, 70) );
+}
@@ -4,7 +4,8 @@
 #include "Cell.h"
 #include "Common.h"
 #include "Config.h"
-#include "image_hash/hamming_distance.h"
+#include "image_hash/hamming_search.h"
+#include "image_hash/hash_index.h"
 #include "serialize/format.h"
 
 #include <algorithm>
@@ -54,14 +55,17 @@ namespace {
 	}
 }
 
-CimbDecoder::CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark, uchar ahashThreshold)
-	: _symbolBits(symbol_bits)
+CimbDecoder::CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark, uchar ahashThreshold, bool useIndex)
+	: _nearest(image_hash::pick_nearest())
+	, _symbolBits(symbol_bits)
 	, _numSymbols(1 << symbol_bits)
 	, _numColors(1 << color_bits)
 	, _dark(dark)
 	, _ahashThreshold(ahashThreshold)
 {
 	load_tiles();
+	if (useIndex)
+		_tileIndex = image_hash::hash_index(_tileHashes);
 }
 
 // protected
@@ -114,17 +118,17 @@ unsigned CimbDecoder::get_best_symbol(image_hash::ahash_result<cimbar::Config::c
 		// ~0U is "unset"
 		if (drift_idx == cooldown and drift_idx != 4) // don't skip the center, obvs
 			continue;
-		for (unsigned i = 0; i < _tileHashes.size(); ++i)
+
+		// all the tiles at once. Ties go to the lowest tile index, same as checking them one by one.
+		unsigned key = _tileIndex.empty()? _nearest(h, _tileHashes.data(), _tileHashes.size()) : _tileIndex.nearest(h);
+		unsigned distance = key >> 8;
+		if (distance < best_distance)
 		{
-			unsigned distance = image_hash::hamming_distance(h, _tileHashes[i]);
-			if (distance < best_distance)
-			{
-				best_distance = distance;
-				best_fit = i;
-				drift_offset = drift_idx;
-				if (best_distance == 0)
-					return best_fit;
-			}
+			best_distance = distance;
+			best_fit = key & 0xFF;
+			drift_offset = drift_idx;
+			if (best_distance == 0)
+				return best_fit;
 		}
 	}
 	return best_fit;
@@ -6,6 +6,8 @@
 #include "chromatic_adaptation/color_correction.h"
 #include "image_hash/ahash_result.h"
 #include "image_hash/average_hash.h"
+#include "image_hash/hamming_search.h"
+#include "image_hash/hash_index.h"
 #include <opencv2/opencv.hpp>
 #include <cstdint>
 #include <string>
@@ -13,7 +15,9 @@
 class CimbDecoder
 {
 public:
-	CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark=true, uchar ahashThreshold=0);
+	// useIndex swaps the SIMD tile scan for image_hash::hash_index. Same answers, different speed -- which one wins depends on the cpu.
+	// so it's off until the nearest_scan/nearest_index kernels in cimbar_bench say otherwise on the devices we care about.
+	CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark=true, uchar ahashThreshold=0, bool useIndex=false);
 
 	const color_correction& get_ccm() const;
 	void update_color_correction(cv::Matx<float, 3, 3>&& ccm);
@@ -41,6 +45,8 @@ protected:
 
 protected:
 	std::vector<uint64_t> _tileHashes;
+	image_hash::nearest_fun _nearest; // the SIMD tile search, if this cpu has one
+	image_hash::hash_index _tileIndex; // empty unless useIndex
 	unsigned _symbolBits;
 	unsigned _numSymbols;
 	unsigned _numColors;
@@ -4,12 +4,16 @@
 #include "CellDrift.h"
 #include "Common.h"
 #include "Config.h"
-#include "Interleave.h"
 
 #include "bit_file/bitmatrix.h"
 #include "chromatic_adaptation/adaptation_transform.h"
 #include "chromatic_adaptation/color_correction.h"
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 using namespace cimbar;
 
@@ -45,6 +49,58 @@ namespace {
 		return bb;
 	}
 
+	// preprocessSymbolGrid(), for the size*size block of the deskewed image at (x,y)
+	// the sampled window has enough border that the sharpen + box filter see the same neighbors they would on the whole grid.
+	bitbuffer preprocessSymbolWindow(const HomographySampler& sampler, int x, int y, unsigned size, bool needs_sharpen)
+	{
+		constexpr int maxLen = Config::cell_size() + 2 + 8;
+		int blockSize = needs_sharpen? 7 : 5;
+		int r = blockSize / 2;
+		int len = size + 2*r;
+
+		std::array<uint8_t, maxLen*maxLen> gray;
+		std::array<uint8_t, maxLen*maxLen> sharp;
+		const uint8_t* src = gray.data();
+		if (needs_sharpen)
+		{
+			// one more pixel of border for the 3x3 kernel
+			int glen = len + 2;
+			sampler.gray(x - r - 1, y - r - 1, glen, glen, gray.data());
+			for (int j = 0; j < len; ++j)
+				for (int i = 0; i < len; ++i)
+				{
+					const uint8_t* g = gray.data() + (j+1)*glen + i+1;
+					float v = 4.5f*g[0] - g[-glen] - g[glen] - g[-1] - g[1];
+					sharp[j*len + i] = cv::saturate_cast<uint8_t>(v);
+				}
+			src = sharp.data();
+		}
+		else
+			sampler.gray(x - r, y - r, len, len, gray.data());
+
+		// ADAPTIVE_THRESH_MEAN_C with C=0: 1 if the pixel is brighter than the (rounded) mean of its block
+		std::array<unsigned, (maxLen+1)*(maxLen+1)> integral = {};
+		int ilen = len + 1;
+		for (int j = 0; j < len; ++j)
+			for (int i = 0; i < len; ++i)
+				integral[(j+1)*ilen + i+1] = src[j*len + i] + integral[j*ilen + i+1] + integral[(j+1)*ilen + i] - integral[j*ilen + i];
+
+		unsigned area = blockSize * blockSize;
+		bitbuffer bb((size*size + 7) / 8);
+		for (unsigned j = 0; j < size; ++j)
+		{
+			unsigned row = 0;
+			for (unsigned i = 0; i < size; ++i)
+			{
+				unsigned sum = integral[(j+blockSize)*ilen + i+blockSize] - integral[j*ilen + i+blockSize] - integral[(j+blockSize)*ilen + i] + integral[j*ilen + i];
+				unsigned mean = (sum + area/2) / area;
+				row = (row << 1) | (src[(j+r)*len + i+r] > mean);
+			}
+			bb.write(row, j*size, size);
+		}
+		return bb;
+	}
+
 	void updateMaxColor(std::tuple<float, float, float>& max_color, const cv::Scalar& c)
 	{
 		std::get<0>(max_color) = std::max(std::get<0>(max_color), static_cast<float>(c[0]));
@@ -52,7 +108,8 @@ namespace {
 		std::get<2>(max_color) = std::max(std::get<2>(max_color), static_cast<float>(c[2]));
 	}
 
-	std::tuple<float, float, float> calculateWhite(const cv::Mat& img, unsigned padding, bool dark)
+	template <typename CROP>
+	std::tuple<float, float, float> calculateWhite(const CROP& crop, unsigned padding, bool dark)
 	{
 		std::tuple<float, float, float> bestColor({1, 1, 1});
 		if (dark)
@@ -63,8 +120,7 @@ namespace {
 			std::array<std::pair<unsigned, unsigned>, 3> anchors = {{ {tl, tl}, {tl, bottom}, {right, tl} }};
 			for (auto [x, y] : anchors)
 			{
-				cv::Rect crop(x, y, 4, 4);
-				cv::Scalar avgColor = cv::mean(img(crop));
+				cv::Scalar avgColor = cv::mean(crop(cv::Rect(x, y, 4, 4)));
 				updateMaxColor(bestColor, avgColor);
 			}
 		}
@@ -77,17 +133,17 @@ namespace {
 			std::array<std::pair<unsigned, unsigned>, 4> anchors = {{ {0, tl}, {tl, 0}, {0, bottom}, {right, 0} }};
 			for (auto [x, y] : anchors)
 			{
-				cv::Rect crop(x, y, 4, 4);
-				cv::Scalar avgColor = cv::mean(img(crop));
+				cv::Scalar avgColor = cv::mean(crop(cv::Rect(x, y, 4, 4)));
 				updateMaxColor(bestColor, avgColor);
 			}
 		}
 		return bestColor;
 	}
 
-	bool simpleColorCorrection(const cv::Mat& img, CimbDecoder& decoder, unsigned padding)
+	template <typename CROP>
+	bool simpleColorCorrection(const CROP& crop, CimbDecoder& decoder, unsigned padding)
 	{
-		std::tuple<float, float, float> white = calculateWhite(img, padding, Config::dark());
+		std::tuple<float, float, float> white = calculateWhite(crop, padding, Config::dark());
 		decoder.update_color_correction(color_correction::get_adaptation_matrix<adaptation_transform::von_kries>(white, {255.0, 255.0, 255.0}));
 		return true;
 	}
@@ -110,19 +166,16 @@ CimbReader::CimbReader(const cv::Mat& img, CimbDecoder& decoder, unsigned color_
 	, _radioactiveBlockId(0) // can only compute once we know the file size
 	, _cellSize(Config::cell_size() + 2)
 	, _gridPadding(std::min(_image.cols - Config::image_size_x(), _image.rows - Config::image_size_y())/2)
-	, _positions(
-		  cimbar::vec_xy{Config::cell_spacing_x(), Config::cell_spacing_y()},
-		  cimbar::vec_xy{Config::cells_per_col_x(), Config::cells_per_col_y()},
-		  Config::cell_offset()+_gridPadding, cimbar::vec_xy{Config::corner_padding_x(), Config::corner_padding_y()}
-	)
+	, _layout(GridLayout::get(_gridPadding))
+	, _positions(_layout)
 	, _decoder(decoder)
 	, _good(_image.cols >= Config::image_size_x() and _image.rows >= Config::image_size_y())
 	, _colorCorrection(color_correction)
 	, _colorMode(color_mode)
+	, _needsSharpen(needs_sharpen)
 {
 	_grayscale = preprocessSymbolGrid(img, needs_sharpen);
-	if (_good and color_correction == 1)
-		simpleColorCorrection(_image, decoder, _gridPadding);
+	init_simple_ccm();
 }
 
 CimbReader::CimbReader(const cv::UMat& img, CimbDecoder& decoder, unsigned color_mode, bool needs_sharpen, int color_correction)
@@ -130,9 +183,43 @@ CimbReader::CimbReader(const cv::UMat& img, CimbDecoder& decoder, unsigned color
 {
 }
 
+CimbReader::CimbReader(const cv::Mat& frame, const cv::Mat& transform, CimbDecoder& decoder, unsigned color_mode, bool needs_sharpen, int color_correction)
+	: _sampler(frame, transform)
+	, _fountainColorHeader(0U)
+	, _radioactiveBlockId(0)
+	, _cellSize(Config::cell_size() + 2)
+	, _gridPadding(0)
+	, _layout(GridLayout::get(_gridPadding))
+	, _positions(_layout)
+	, _decoder(decoder)
+	, _good(!frame.empty())
+	, _colorCorrection(color_correction)
+	, _colorMode(color_mode)
+	, _needsSharpen(needs_sharpen)
+{
+	init_simple_ccm();
+}
+
+cv::Mat CimbReader::block(const cv::Rect& r) const
+{
+	if (_sampler.empty())
+		return _image(r);
+	return _sampler.rgb(r.x, r.y, r.width, r.height);
+}
+
+// Cell wants a continuous image, so when reading from the frame the block is sampled into `buffer`
+Cell CimbReader::cell(const cv::Rect& r, cv::Mat& buffer) const
+{
+	if (_sampler.empty())
+		return Cell(_image, r.x, r.y, r.width, r.height);
+	buffer = _sampler.rgb(r.x, r.y, r.width, r.height);
+	return Cell(buffer);
+}
+
 unsigned CimbReader::read_color(const PositionData& pos) const
 {
-	Cell color_cell(_image, pos.x, pos.y, Config::cell_size(), Config::cell_size());
+	cv::Mat buffer;
+	Cell color_cell = cell(cv::Rect(pos.x, pos.y, Config::cell_size(), Config::cell_size()), buffer);
 	return _decoder.decode_color(color_cell, _colorMode);
 }
 
@@ -143,17 +230,32 @@ unsigned CimbReader::read(PositionData& pos)
 
 	// need coordinate, index, and drift from next position
 	auto [i, xy, drift, cooldown] = _positions.next();
+	return read_cell(_positions, i, xy, drift, cooldown, pos);
+}
+
+template <typename FLOOD>
+unsigned CimbReader::read_cell(FLOOD& flood, unsigned i, const CellPositions::coordinate& xy, CellDrift drift, uint8_t cooldown, PositionData& pos) const
+{
 	int x = xy.first + drift.x();
 	int y = xy.second + drift.y();
-	bitmatrix cell(_grayscale, _image.cols, _image.rows, x-1, y-1);
 
 	unsigned drift_offset = 0;
 	unsigned error_distance;
-	unsigned bits = _decoder.decode_symbol(cell, drift_offset, error_distance, cooldown);
+	unsigned bits;
+	if (_sampler.empty())
+	{
+		bitmatrix cell(_grayscale, _image.cols, _image.rows, x-1, y-1);
+		bits = _decoder.decode_symbol(cell, drift_offset, error_distance, cooldown);
+	}
+	else
+	{
+		bitbuffer window = preprocessSymbolWindow(_sampler, x-1, y-1, _cellSize, _needsSharpen);
+		bits = _decoder.decode_symbol(bitmatrix(window, _cellSize, _cellSize), drift_offset, error_distance, cooldown);
+	}
 
 	std::pair<int, int> best_drift = CellDrift::driftPairs[drift_offset];
 	drift.updateDrift(best_drift.first, best_drift.second);
-	_positions.update(i, drift, error_distance, CellDrift::calculate_cooldown(cooldown, drift_offset));
+	flood.update(i, drift, error_distance, CellDrift::calculate_cooldown(cooldown, drift_offset));
 
 	pos.i = i;
 	pos.x = x + best_drift.first;
@@ -161,6 +263,75 @@ unsigned CimbReader::read(PositionData& pos)
 	return bits;
 }
 
+std::vector<std::pair<PositionData, unsigned>> CimbReader::read_parallel(const executor& execute, unsigned helpers)
+{
+	std::vector<std::pair<PositionData, unsigned>> res;
+	if (done())
+		return res;
+
+	std::vector<FloodDecodePositions::region> regions = _positions.split();
+	std::vector<std::vector<std::pair<PositionData, unsigned>>> found(regions.size());
+	const unsigned count = regions.size();
+	helpers = execute? std::min(helpers, count - 1) : 0;
+
+	// shared with the helpers, which can outlive this call if they start late. They only touch
+	// `regions` and `found` after claiming one, and we don't return until every claimed region is finished.
+	struct progress
+	{
+		std::atomic<unsigned> next = 0;
+		unsigned finished = 0;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+	std::shared_ptr<progress> prog = std::make_shared<progress>();
+
+	// symbol reads only need the constexpr bits of the (per thread) Config, so the helpers don't need to set it up
+	auto work = [this, prog, count, &regions, &found] () {
+		for (unsigned r = prog->next++; r < count; r = prog->next++)
+		{
+			while (!regions[r].done())
+			{
+				auto [i, xy, drift, cooldown] = regions[r].next();
+				PositionData pos;
+				unsigned bits = read_cell(regions[r], i, xy, drift, cooldown, pos);
+				found[r].push_back({pos, bits});
+			}
+
+			std::lock_guard<std::mutex> lock(prog->mutex);
+			if (++prog->finished == count)
+				prog->cv.notify_all();
+		}
+	};
+
+	for (unsigned h = 0; h < helpers; ++h)
+		execute(work);
+	work();
+	{
+		std::unique_lock<std::mutex> lock(prog->mutex);
+		prog->cv.wait(lock, [&prog, count] () { return prog->finished == count; });
+	}
+
+	for (const auto& f : found)
+		res.insert(res.end(), f.begin(), f.end());
+
+	// then the seam, one cell at a time
+	_positions.merge(regions);
+	while (!done())
+	{
+		PositionData pos;
+		unsigned bits = read(pos);
+		res.push_back({pos, bits});
+	}
+	return res;
+}
+
+// the ccm is per thread. If colors are read on a different thread than the one that constructed us, call this there first.
+void CimbReader::init_simple_ccm()
+{
+	if (_good and _colorCorrection == 1)
+		simpleColorCorrection([this] (const cv::Rect& r) { return block(r); }, _decoder, _gridPadding);
+}
+
 bool CimbReader::done() const
 {
 	return !_good or _positions.done();
@@ -183,7 +354,8 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 	// full ccm, using header values as known color index
 	// 1. get positions
 	// 2. put fountain header into a bitbuffer so we can read decoder.color_bits() bits at a time
-	CellPositions::positions_list positions = Interleave::interleave(_positions.positions(), interleave_blocks, interleave_partitions);
+	std::shared_ptr<const GridLayout> layout = this->layout(interleave_blocks, interleave_partitions);
+	const CellPositions::positions_list& positions = layout->interleaved_positions();
 
 	// 3. using expected fountain headers, decode color for each position
 	unsigned end = cimbar::Config::capacity(color_bits) * 8 / color_bits;
@@ -213,7 +385,8 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 			//Cell color_cell(_image, pos.first, pos.second, Config::cell_size(), Config::cell_size());
 			//auto col = _decoder.avg_color(color_cell); // could just call cell mean_rgb directly?
 
-			Cell color_cell(_image, pos.first+1, pos.second+1, Config::cell_size()-2, Config::cell_size()-2);
+			cv::Mat buffer;
+			Cell color_cell = cell(cv::Rect(pos.first+1, pos.second+1, Config::cell_size()-2, Config::cell_size()-2), buffer);
 			auto col = color_cell.mean_rgb();
 
 			auto [it, isNew] = colors.try_emplace(expected, std::make_tuple(0, 0, 0, 0)); // count,r,g,b
@@ -254,7 +427,7 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 
 	// 5. sample corners
 	{
-		std::tuple<float, float, float> white = calculateWhite(_image, _gridPadding, Config::dark());
+		std::tuple<float, float, float> white = calculateWhite([this] (const cv::Rect& r) { return block(r); }, _gridPadding, Config::dark());
 		cv::Mat arow = (cv::Mat_<float>(1,3) << std::get<0>(white), std::get<1>(white), std::get<2>(white));
 		actual.push_back(arow);
 
@@ -283,3 +456,16 @@ unsigned CimbReader::num_reads() const
 {
 	return _positions.size();
 }
+
+std::shared_ptr<const GridLayout> CimbReader::layout(unsigned interleave_blocks, unsigned interleave_partitions) const
+{
+	const GridLayout::params& p = _layout->layout_params();
+	if (p.interleave_blocks == interleave_blocks and p.interleave_partitions == interleave_partitions)
+		return _layout;
+	return GridLayout::get(_gridPadding, interleave_blocks, interleave_partitions);
+}
+
+bitbuffer CimbReader::preprocess_symbol_grid(const cv::Mat& img, bool needs_sharpen)
+{
+	return preprocessSymbolGrid(img, needs_sharpen);
+}
@@ -1,40 +1,75 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "Cell.h"
 #include "CimbDecoder.h"
 #include "FloodDecodePositions.h"
+#include "GridLayout.h"
+#include "HomographySampler.h"
 #include "PositionData.h"
 
 #include "bit_file/bitbuffer.h"
 #include "fountain/FountainMetadata.h"
 #include <opencv2/opencv.hpp>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
 
 class CimbReader
 {
 public:
 	CimbReader(const cv::Mat& img, CimbDecoder& decoder, unsigned color_mode, bool needs_sharpen=false, int color_correction=2);
 	CimbReader(const cv::UMat& img, CimbDecoder& decoder, unsigned color_mode, bool needs_sharpen=false, int color_correction=2);
+	// read straight from the camera frame. transform maps frame coordinates -> the (unpadded) deskewed image, e.g. Deskewer::get_transform().
+	// only the pixels around the cells we read get sampled, so there is no deskewed image or full grid threshold to build.
+	CimbReader(const cv::Mat& frame, const cv::Mat& transform, CimbDecoder& decoder, unsigned color_mode, bool needs_sharpen=false, int color_correction=2);
 
 	unsigned read(PositionData& pos);
+	// hands a task to someone else's threads, e.g. [&pool] (std::function<void()> fun) { pool.execute(fun); }
+	using executor = std::function<void(std::function<void()>)>;
+
+	// every symbol in one go, instead of read() until done(). The flood's seed regions are shared out between this thread
+	// and up to `helpers` tasks given to `execute`, then the seams between them are read on this one.
+	// a region goes to whoever asks for it first, so we never wait on a task that hasn't started: if the pool is busy
+	// (or this is one of its own threads), we just read more of them ourselves. The results (and their order) don't
+	// depend on who read what. call it before any read().
+	std::vector<std::pair<PositionData, unsigned>> read_parallel(const executor& execute, unsigned helpers);
 	unsigned read_color(const PositionData& pos) const;
 	bool done() const;
 
 	void init_ccm(unsigned color_bits, unsigned interleave_blocks, unsigned interleave_partitions, unsigned fountain_blocks);
+	void init_simple_ccm();
 	void update_metadata(char* buff, unsigned len, unsigned chunk_size);
 
 	unsigned num_reads() const;
+	// our cell layout, with this interleave. Shared, so hang on to the pointer while using it
+	std::shared_ptr<const GridLayout> layout(unsigned interleave_blocks, unsigned interleave_partitions) const;
+
+	// exposed for benchmarking
+	static bitbuffer preprocess_symbol_grid(const cv::Mat& img, bool needs_sharpen=false);
+
+protected:
+	template <typename FLOOD>
+	unsigned read_cell(FLOOD& flood, unsigned i, const CellPositions::coordinate& xy, CellDrift drift, uint8_t cooldown, PositionData& pos) const;
+
+	cv::Mat block(const cv::Rect& r) const;
+	Cell cell(const cv::Rect& r, cv::Mat& buffer) const;
 
 protected:
 	cv::Mat _image;
+	HomographySampler _sampler;
 	bitbuffer _grayscale;
 	FountainMetadata _fountainColorHeader;
 	unsigned _radioactiveBlockId;
 
 	unsigned _cellSize;
 	unsigned _gridPadding;
+	std::shared_ptr<const GridLayout> _layout;
 	FloodDecodePositions _positions;
 	CimbDecoder& _decoder;
 	bool _good;
 	int _colorCorrection;
 	unsigned _colorMode;
+	bool _needsSharpen;
 };
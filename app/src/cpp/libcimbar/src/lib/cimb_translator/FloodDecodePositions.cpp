@@ -1,44 +1,38 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #include "FloodDecodePositions.h"
+#include <algorithm>
 #include <iostream>
 
-FloodDecodePositions::FloodDecodePositions(cimbar::vec_xy spacing, cimbar::vec_xy dimensions, int offset, cimbar::vec_xy marker_size)
-	: _positions(CellPositions::compute(spacing, dimensions, offset, marker_size, 0))
-	, _cellFinder(_positions, dimensions, marker_size)
+FloodDecodePositions::FloodDecodePositions(std::shared_ptr<const GridLayout> layout)
+	: _layout(std::move(layout))
 {
 	reset();
 }
 
+FloodDecodePositions::FloodDecodePositions(cimbar::vec_xy spacing, cimbar::vec_xy dimensions, int offset, cimbar::vec_xy marker_size)
+	: FloodDecodePositions(std::make_shared<GridLayout>(GridLayout::params{spacing, dimensions, offset, marker_size}))
+{
+}
+
 size_t FloodDecodePositions::size() const
 {
-	return _positions.size();
+	return _layout->size();
 }
 
 void FloodDecodePositions::reset()
 {
 	_index = 0;
 	_count = 0;
-	_remaining.clear();
-	for (unsigned i = 0; i < _positions.size(); ++i)
-	{
-		_remaining.push_back(true);
-		_instructions.push_back({CellDrift(), 0xFE, 0xFE});
-	}
+	// assign() reuses the storage after the first frame
+	_remaining.assign(size(), true);
+	_prio.assign(size(), 0xFE);
+	_cooldown.assign(size(), 0xFE);
+	_driftX.assign(size(), 0);
+	_driftY.assign(size(), 0);
 
-	// seed
-	uint16_t smallRowLen = _cellFinder.calc_mid_width();
-	uint16_t lastElem = _positions.size()-1;
-	_heap.push({0, 0});
-	_heap.push({smallRowLen-1, 0});
-	_heap.push({lastElem, 0});
-	_heap.push({lastElem-(smallRowLen-1), 0});
-
-	// add more seed corners?
-	uint16_t betweenMarkerBlock = _cellFinder.first_mid();
-	_heap.push({betweenMarkerBlock, 1});
-	_heap.push({betweenMarkerBlock+_cellFinder.dimensions_x()-1, 1});
-	_heap.push({lastElem-betweenMarkerBlock, 1});
-	_heap.push({lastElem-(betweenMarkerBlock+_cellFinder.dimensions_x()-1), 1});
+	_queue.clear();
+	for (auto [i, prio] : _layout->seeds())
+		_queue.push(i, prio);
 }
 
 bool FloodDecodePositions::done() const
@@ -46,37 +40,50 @@ bool FloodDecodePositions::done() const
 	return _count == size();
 }
 
-FloodDecodePositions::iter FloodDecodePositions::next()
+FloodDecodePositions::iter FloodDecodePositions::pop(decode_queue& queue, unsigned& count)
 {
-	while (!_heap.empty())
+	while (!queue.empty())
 	{
-		auto [i, _] = _heap.top();
-		_heap.pop();
+		unsigned i = queue.top();
+		queue.pop();
 
-		std::vector<bool>::reference needsDecode = _remaining[i];
+		uint8_t& needsDecode = _remaining[i];
 		if (!needsDecode)
 			continue;
 
 		needsDecode = false;
-		++_count;
-		auto [drift, __, cooldown] = _instructions[i];
-		return {i, _positions[i], drift, cooldown};
+		++count;
+		return {i, _layout->positions()[i], CellDrift(_driftX[i], _driftY[i]), _cooldown[i]};
 	}
 
 	return {0, {0, 0}, CellDrift(), 0xFF};
 }
 
-int FloodDecodePositions::update_adjacents(const std::array<int,4>& adj, const CellDrift& drift, unsigned error_distance, uint8_t cooldown)
+FloodDecodePositions::iter FloodDecodePositions::next()
+{
+	return pop(_queue, _count);
+}
+
+bool FloodDecodePositions::push(decode_queue& queue, int next, const decode_instructions& di)
+{
+	if (!_remaining[next] or _prio[next] <= di.prio)
+		return false;
+	_prio[next] = di.prio;
+	_cooldown[next] = di.cooldown;
+	_driftX[next] = di.drift.x();
+	_driftY[next] = di.drift.y();
+	queue.push(next, di.prio);
+	return true;
+}
+
+template <typename PUSH>
+int FloodDecodePositions::update_adjacents(const std::array<int,4>& adj, const CellDrift& drift, unsigned error_distance, uint8_t cooldown, PUSH&& push)
 {
 	for (int next : adj)
 	{
-		if (next < 0 or !_remaining[next])
-			continue;
-		decode_instructions& di = _instructions[next];
-		if (std::get<1>(di) <= error_distance)
+		if (next < 0)
 			continue;
-		di = {drift, error_distance, cooldown};
-		_heap.push({next, error_distance});
+		push(next, decode_instructions{drift, static_cast<uint8_t>(error_distance), cooldown});
 	}
 
 	return 0;
@@ -84,10 +91,19 @@ int FloodDecodePositions::update_adjacents(const std::array<int,4>& adj, const C
 
 int FloodDecodePositions::update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown)
 {
-	std::array<int,4> adj = _cellFinder.find(index);
-	update_adjacents(adj, drift, error_distance, cooldown);
+	return update(index, drift, error_distance, cooldown, [this] (int next, const decode_instructions& di) {
+		push(_queue, next, di);
+	});
+}
+
+template <typename PUSH>
+int FloodDecodePositions::update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown, PUSH&& push)
+{
+	const std::array<int,4>& adj = _layout->adjacent(index);
+	update_adjacents(adj, drift, error_distance, cooldown, push);
 
-	auto& [_, prev_error, prev_cooldown] = _instructions[index];
+	uint8_t& prev_error = _prio[index];
+	uint8_t& prev_cooldown = _cooldown[index];
 	// in the case where we have consecutive high confidence cells with no drift changes,
 	// it's safe(ish) to aggressively queue a few more cells
 	if (prev_error < 3 and error_distance < 3 and prev_cooldown == 4 and cooldown == 4)
@@ -102,14 +118,14 @@ int FloodDecodePositions::update(unsigned index, const CellDrift& drift, unsigne
 		if (rridx >= 0 and llidx >= 0)
 		{
 			std::array<int,4> horizon = {-1, -1, -1, -1};
-			horizon[0] = _cellFinder.right(rridx);
+			horizon[0] = _layout->adjacent(rridx)[rr];
 			if (horizon[0] >= 0)
-				horizon[1] = _cellFinder.right(horizon[0]);
-			horizon[2] = _cellFinder.left(llidx);
+				horizon[1] = _layout->adjacent(horizon[0])[rr];
+			horizon[2] = _layout->adjacent(llidx)[ll];
 			if (horizon[2] >= 0)
-				horizon[3] = _cellFinder.left(horizon[2]);
+				horizon[3] = _layout->adjacent(horizon[2])[ll];
 
-			update_adjacents(horizon, drift, error_distance, cooldown);
+			update_adjacents(horizon, drift, error_distance, cooldown, push);
 		}
 
 		int uuidx = adj[uu];
@@ -117,14 +133,14 @@ int FloodDecodePositions::update(unsigned index, const CellDrift& drift, unsigne
 		if (uuidx >= 0 and ddidx >= 0)
 		{
 			std::array<int,4> vert = {-1, -1, -1, -1};
-			vert[0] = _cellFinder.top(uuidx);
+			vert[0] = _layout->adjacent(uuidx)[uu];
 			if (vert[0] >= 0)
-				vert[1] = _cellFinder.top(vert[0]);
-			vert[2] = _cellFinder.bottom(ddidx);
+				vert[1] = _layout->adjacent(vert[0])[uu];
+			vert[2] = _layout->adjacent(ddidx)[dd];
 			if (vert[2] >= 0)
-				vert[3] = _cellFinder.bottom(vert[2]);
+				vert[3] = _layout->adjacent(vert[2])[dd];
 
-			update_adjacents(vert, drift, error_distance, cooldown);
+			update_adjacents(vert, drift, error_distance, cooldown, push);
 		}
 	}
 
@@ -133,7 +149,114 @@ int FloodDecodePositions::update(unsigned index, const CellDrift& drift, unsigne
 	return 0;
 }
 
+std::vector<FloodDecodePositions::region> FloodDecodePositions::split()
+{
+	std::vector<region> regions;
+	const std::vector<decode_prio>& seeds = _layout->seeds();
+	for (unsigned r = 0; r < seeds.size(); ++r)
+		regions.emplace_back(*this, r, seeds[r]);
+	_queue.clear();
+	return regions;
+}
+
+void FloodDecodePositions::merge(const std::vector<region>& regions)
+{
+	// region order, then the order each region found them in
+	for (const region& r : regions)
+	{
+		_count += r._count;
+		for (auto&& [next, di] : r._seam)
+			push(_queue, next, di);
+	}
+
+	// and a last resort for anything no neighbor could reach
+	for (unsigned i = 0; i < _remaining.size(); ++i)
+		if (_remaining[i])
+			_queue.push(i, 0xFF);
+}
+
+uint8_t FloodDecodePositions::owner(unsigned index) const
+{
+	return _layout->owner(index);
+}
+
 const CellPositions::positions_list& FloodDecodePositions::positions() const
 {
-	return _positions;
+	return _layout->positions();
+}
+
+const GridLayout& FloodDecodePositions::layout() const
+{
+	return *_layout;
+}
+
+FloodDecodePositions::region::region(FloodDecodePositions& fdp, uint8_t id, const decode_prio& seed)
+	: _fdp(fdp)
+	, _id(id)
+	, _count(0)
+{
+	_queue.push(std::get<0>(seed), std::get<1>(seed));
+}
+
+bool FloodDecodePositions::region::done()
+{
+	// drop anything we've already decoded, so an empty queue means we're out of cells
+	while (!_queue.empty() and !_fdp._remaining[_queue.top()])
+		_queue.pop();
+	return _queue.empty();
+}
+
+FloodDecodePositions::iter FloodDecodePositions::region::next()
+{
+	return _fdp.pop(_queue, _count);
+}
+
+int FloodDecodePositions::region::update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown)
+{
+	// our cells go on our queue. The seam is someone else's problem (merge()'s), and other regions are off limits.
+	return _fdp.update(index, drift, error_distance, cooldown, [this] (int next, const decode_instructions& di) {
+		uint8_t owner = _fdp._layout->owner(next);
+		if (owner == _id)
+			_fdp.push(_queue, next, di);
+		else if (owner == SEAM)
+			_seam.push_back({next, di});
+	});
+}
+
+namespace {
+	class PrioCompare
+	{
+	public:
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return (a >> 16) > (b >> 16);
+		}
+	};
+}
+
+bool FloodDecodePositions::decode_queue::empty() const
+{
+	return _heap.empty();
+}
+
+uint16_t FloodDecodePositions::decode_queue::top() const
+{
+	return _heap.front() & 0xFFFF;
+}
+
+void FloodDecodePositions::decode_queue::push(uint16_t index, uint8_t prio)
+{
+	_heap.push_back((uint32_t(prio) << 16) | index);
+	std::push_heap(_heap.begin(), _heap.end(), PrioCompare());
+}
+
+void FloodDecodePositions::decode_queue::pop()
+{
+	std::pop_heap(_heap.begin(), _heap.end(), PrioCompare());
+	_heap.pop_back();
+}
+
+void FloodDecodePositions::decode_queue::clear()
+{
+	_heap.clear();
 }
@@ -1,33 +1,74 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
-#include "AdjacentCellFinder.h"
 #include "CellDrift.h"
 #include "CellPositions.h"
+#include "GridLayout.h"
+#include <array>
 #include <cstdint>
-#include <queue>
-#include <set>
+#include <memory>
 #include <tuple>
+#include <vector>
 
 class FloodDecodePositions
 {
 public:
 	using iter = std::tuple<unsigned, CellPositions::coordinate, CellDrift, uint8_t>;
-	// compress these types down to reduce size and cache pressure?
-	// i.e. with a struct ...
-	using decode_instructions = std::tuple<CellDrift, uint8_t, uint8_t>; // drift, best_prio, cooldown_pos
-	using decode_prio = std::tuple<uint16_t, uint8_t>; // index, prio
+	using decode_prio = GridLayout::seed; // index, prio
 
-	class PrioCompare
+	// what a decoded cell tells its neighbors
+	struct decode_instructions
+	{
+		CellDrift drift;
+		uint8_t prio;
+		uint8_t cooldown;
+	};
+
+	// a min heap on prio. Entries are packed into one word (prio above index) to keep it small, but only the prio is
+	// compared: ties come out in whatever order the heap leaves them, same as the std::priority_queue this replaced.
+	// the decode order -- and so the decoded output -- depends on that, so don't "fix" it with a stable queue.
+	class decode_queue
 	{
 	public:
-		bool operator()(const decode_prio& a, const decode_prio& b) const
-		{
-			return std::get<1>(a) > std::get<1>(b);
-		}
+		bool empty() const;
+		uint16_t top() const;
+		void push(uint16_t index, uint8_t prio);
+		void pop();
+		void clear();
+
+	protected:
+		std::vector<uint32_t> _heap; // capacity survives clear(), so after the first frame this doesn't allocate
 	};
 
+	// the parallel flood. Each seed from reset() owns the cells closer to it than to any other seed, and a region floods
+	// only its own cells -- with its own queue -- so regions can be decoded on separate threads.
+	// the cells along the borders between regions (the "seam") are left for merge(), which floods them serially,
+	// starting from the drift/cooldown the regions found on either side. Every step is in a fixed order, so the result
+	// doesn't depend on thread timing.
+	class region
+	{
+	public:
+		region(FloodDecodePositions& fdp, uint8_t id, const decode_prio& seed);
+
+		bool done();
+		iter next();
+		int update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown);
+
+	protected:
+		friend class FloodDecodePositions;
+
+		FloodDecodePositions& _fdp;
+		uint8_t _id;
+		unsigned _count;
+		decode_queue _queue;
+		std::vector<std::tuple<unsigned, decode_instructions>> _seam; // what we would have told our neighbors
+	};
+
+	static constexpr uint8_t SEAM = GridLayout::SEAM;
+
 public:
+	// the layout is shared (see GridLayout::get()). Only the decode state is ours
+	explicit FloodDecodePositions(std::shared_ptr<const GridLayout> layout);
 	FloodDecodePositions(cimbar::vec_xy spacing, cimbar::vec_xy dimensions, int offset, cimbar::vec_xy marker_size);
 
 	size_t size() const;
@@ -37,19 +78,35 @@ public:
 	iter next();
 	int update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown);
 
+	// call right after reset(). Each region can then be run (next()/update() until done()) on its own thread.
+	std::vector<region> split();
+	// ... and once they're all done, this queues up the seam. Use next()/update() as normal from there.
+	void merge(const std::vector<region>& regions);
+	uint8_t owner(unsigned index) const;
+
 	const CellPositions::positions_list& positions() const;
+	const GridLayout& layout() const;
 
 protected:
-	int update_adjacents(const std::array<int,4>& adj, const CellDrift& drift, unsigned error_distance, uint8_t cooldown);
+	template <typename PUSH>
+	int update_adjacents(const std::array<int,4>& adj, const CellDrift& drift, unsigned error_distance, uint8_t cooldown, PUSH&& push);
+	template <typename PUSH>
+	int update(unsigned index, const CellDrift& drift, unsigned error_distance, uint8_t cooldown, PUSH&& push);
+
+	iter pop(decode_queue& queue, unsigned& count);
+	bool push(decode_queue& queue, int next, const decode_instructions& di);
 
 protected:
+	std::shared_ptr<const GridLayout> _layout;
 	unsigned _index;
 	unsigned _count;
-	std::priority_queue<decode_prio, std::vector<decode_prio>, PrioCompare> _heap;
-	std::vector<bool> _remaining;
-	std::vector<decode_instructions> _instructions;
-	CellPositions::positions_list _positions;
-	AdjacentCellFinder _cellFinder;
-	int _topWidth;
+	decode_queue _queue;
+
+	// per cell state, one array per field: the hot loop mostly wants _remaining and _prio
+	std::vector<uint8_t> _remaining;
+	std::vector<uint8_t> _prio; // the best (lowest) error a neighbor has offered. Then once decoded, our own error
+	std::vector<uint8_t> _cooldown;
+	std::vector<int8_t> _driftX;
+	std::vector<int8_t> _driftY;
 };
 
@@ -0,0 +1,166 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "GridLayout.h"
+
+#include "AdjacentCellFinder.h"
+#include "Config.h"
+#include "Interleave.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <queue>
+
+namespace {
+	// there's one layout per mode (and padding, and interleave setting) in practice. This is just so odd inputs can't grow it forever
+	constexpr unsigned MAX_LAYOUTS = 16;
+}
+
+bool GridLayout::params::operator<(const params& other) const
+{
+	return std::tie(spacing.x, spacing.y, dimensions.x, dimensions.y, offset, marker_size.x, marker_size.y, interleave_blocks, interleave_partitions)
+		< std::tie(other.spacing.x, other.spacing.y, other.dimensions.x, other.dimensions.y, other.offset, other.marker_size.x, other.marker_size.y,
+				   other.interleave_blocks, other.interleave_partitions);
+}
+
+std::shared_ptr<const GridLayout> GridLayout::get(unsigned padding)
+{
+	return get(padding, cimbar::Config::interleave_blocks(), cimbar::Config::interleave_partitions());
+}
+
+std::shared_ptr<const GridLayout> GridLayout::get(unsigned padding, unsigned interleave_blocks, unsigned interleave_partitions)
+{
+	using cimbar::Config;
+	params p;
+	p.spacing = {Config::cell_spacing_x(), Config::cell_spacing_y()};
+	p.dimensions = {Config::cells_per_col_x(), Config::cells_per_col_y()};
+	p.offset = Config::cell_offset() + padding;
+	p.marker_size = {Config::corner_padding_x(), Config::corner_padding_y()};
+	p.interleave_blocks = interleave_blocks;
+	p.interleave_partitions = interleave_partitions;
+	return get(p);
+}
+
+std::shared_ptr<const GridLayout> GridLayout::get(const params& p)
+{
+	static std::mutex mutex;
+	static std::map<params, std::shared_ptr<const GridLayout>> layouts;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = layouts.find(p);
+		if (it != layouts.end())
+			return it->second;
+	}
+
+	// build it outside the lock. If another thread beats us to it, theirs wins
+	std::shared_ptr<const GridLayout> layout = std::make_shared<GridLayout>(p);
+	std::lock_guard<std::mutex> lock(mutex);
+	if (layouts.size() >= MAX_LAYOUTS)
+		layouts.clear();
+	return layouts.try_emplace(p, layout).first->second;
+}
+
+GridLayout::GridLayout(const params& p)
+	: _params(p)
+	, _positions(CellPositions::compute(p.spacing, p.dimensions, p.offset, p.marker_size, 0))
+{
+	AdjacentCellFinder cellFinder(_positions, p.dimensions, p.marker_size);
+	_adjacent.reserve(_positions.size());
+	for (unsigned i = 0; i < _positions.size(); ++i)
+		_adjacent.push_back(cellFinder.find(i));
+
+	// seed
+	uint16_t smallRowLen = cellFinder.calc_mid_width();
+	uint16_t lastElem = _positions.size()-1;
+	_seeds.push_back({0, 0});
+	_seeds.push_back({smallRowLen-1, 0});
+	_seeds.push_back({lastElem, 0});
+	_seeds.push_back({lastElem-(smallRowLen-1), 0});
+
+	// add more seed corners?
+	uint16_t betweenMarkerBlock = cellFinder.first_mid();
+	_seeds.push_back({betweenMarkerBlock, 1});
+	_seeds.push_back({betweenMarkerBlock+cellFinder.dimensions_x()-1, 1});
+	_seeds.push_back({lastElem-betweenMarkerBlock, 1});
+	_seeds.push_back({lastElem-(betweenMarkerBlock+cellFinder.dimensions_x()-1), 1});
+
+	compute_owners();
+
+	_interleaveLookup = Interleave::interleave_reverse(_positions.size(), p.interleave_blocks, p.interleave_partitions);
+	_interleavedPositions = Interleave::interleave(_positions, p.interleave_blocks, p.interleave_partitions);
+}
+
+// every cell goes to the closest seed (breadth first, so ties go to the earlier seed).
+// then any cell next to another region's cell -- other than a seed -- becomes part of the seam.
+void GridLayout::compute_owners()
+{
+	_owner.assign(_positions.size(), SEAM);
+	std::queue<unsigned> work;
+	for (unsigned r = 0; r < _seeds.size(); ++r)
+	{
+		unsigned seed = std::get<0>(_seeds[r]);
+		_owner[seed] = r;
+		work.push(seed);
+	}
+
+	while (!work.empty())
+	{
+		unsigned i = work.front();
+		work.pop();
+		for (int next : _adjacent[i])
+			if (next >= 0 and _owner[next] == SEAM)
+			{
+				_owner[next] = _owner[i];
+				work.push(next);
+			}
+	}
+
+	std::vector<uint8_t> regions = _owner;
+	for (unsigned i = 0; i < regions.size(); ++i)
+	{
+		bool seed = std::find_if(_seeds.begin(), _seeds.end(), [i] (const GridLayout::seed& s) { return std::get<0>(s) == i; }) != _seeds.end();
+		if (seed)
+			continue;
+		for (int next : _adjacent[i])
+			if (next >= 0 and regions[next] != regions[i])
+				_owner[i] = SEAM;
+	}
+}
+
+const GridLayout::params& GridLayout::layout_params() const
+{
+	return _params;
+}
+
+size_t GridLayout::size() const
+{
+	return _positions.size();
+}
+
+const CellPositions::positions_list& GridLayout::positions() const
+{
+	return _positions;
+}
+
+const std::array<int, 4>& GridLayout::adjacent(unsigned index) const
+{
+	return _adjacent[index];
+}
+
+const std::vector<GridLayout::seed>& GridLayout::seeds() const
+{
+	return _seeds;
+}
+
+uint8_t GridLayout::owner(unsigned index) const
+{
+	return _owner[index];
+}
+
+const std::vector<unsigned>& GridLayout::interleave_lookup() const
+{
+	return _interleaveLookup;
+}
+
+const CellPositions::positions_list& GridLayout::interleaved_positions() const
+{
+	return _interleavedPositions;
+}
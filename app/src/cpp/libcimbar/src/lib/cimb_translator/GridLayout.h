@@ -0,0 +1,71 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "CellPositions.h"
+#include "util/vec_xy.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+// where the cells are, and everything that follows from that: who is next to who, the flood's seeds and regions,
+// and the interleave order. It's all a pure function of the config (plus the grid's padding in the image),
+// so get() builds it once per config and hands the same immutable copy to every frame, on every thread.
+class GridLayout
+{
+public:
+	struct params
+	{
+		cimbar::vec_xy spacing;
+		cimbar::vec_xy dimensions;
+		int offset = 0;
+		cimbar::vec_xy marker_size;
+		unsigned interleave_blocks = 0;
+		unsigned interleave_partitions = 1;
+
+		bool operator<(const params& other) const;
+	};
+
+	using seed = std::tuple<uint16_t, uint8_t>; // index, prio
+
+	static constexpr uint8_t SEAM = 0xFF;
+
+	// for the active Config. padding is the space around the grid in the image -- see CimbReader
+	static std::shared_ptr<const GridLayout> get(unsigned padding=0);
+	static std::shared_ptr<const GridLayout> get(unsigned padding, unsigned interleave_blocks, unsigned interleave_partitions);
+	static std::shared_ptr<const GridLayout> get(const params& p);
+
+public:
+	explicit GridLayout(const params& p);
+
+	GridLayout(const GridLayout&) = delete;
+	GridLayout& operator=(const GridLayout&) = delete;
+
+	const params& layout_params() const;
+	size_t size() const;
+
+	const CellPositions::positions_list& positions() const;
+	// right, left, bottom, top. -1 if there isn't one
+	const std::array<int, 4>& adjacent(unsigned index) const;
+
+	const std::vector<seed>& seeds() const;
+	// the seed region a cell belongs to, or SEAM
+	uint8_t owner(unsigned index) const;
+
+	// cell index -> its place in the interleaved stream. And the other way around, as positions
+	const std::vector<unsigned>& interleave_lookup() const;
+	const CellPositions::positions_list& interleaved_positions() const;
+
+protected:
+	void compute_owners();
+
+protected:
+	params _params;
+	CellPositions::positions_list _positions;
+	std::vector<std::array<int, 4>> _adjacent;
+	std::vector<seed> _seeds;
+	std::vector<uint8_t> _owner;
+	std::vector<unsigned> _interleaveLookup;
+	CellPositions::positions_list _interleavedPositions;
+};
@@ -0,0 +1,123 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+// reads blocks of the deskewed image without ever making it.
+// each pixel is looked up in the source frame through the inverse of the deskew transform, and interpolated.
+// the math is warpPerspective's (INTER_LINEAR, 1/32 pixel steps, black border), so it matches a deskew + crop.
+class HomographySampler
+{
+public:
+	HomographySampler() = default;
+	// transform maps frame coordinates -> deskewed coordinates. e.g. Deskewer::get_transform()
+	HomographySampler(const cv::Mat& frame, const cv::Mat& transform);
+
+	bool empty() const;
+
+	// the w*h block of the deskewed image with its top left at (x,y)
+	cv::Mat rgb(int x, int y, int w, int h) const;
+	// ... as RGB2GRAY would see it. out holds w*h bytes.
+	void gray(int x, int y, int w, int h, uint8_t* out) const;
+
+protected:
+	template <typename FUN>
+	void sample(int x, int y, int w, int h, FUN fun) const;
+
+	void pixel(double sx, double sy, uint8_t* out) const;
+	const uint8_t* at(int x, int y) const;
+
+protected:
+	cv::Mat _frame;
+	int _channels = 0;
+	double _inv[9] = {};
+};
+
+inline HomographySampler::HomographySampler(const cv::Mat& frame, const cv::Mat& transform)
+	: _frame(frame)
+	, _channels(frame.channels())
+{
+	cv::Mat inv;
+	cv::Mat(transform.inv()).convertTo(inv, CV_64F);
+	std::copy(inv.ptr<double>(0), inv.ptr<double>(0) + 9, _inv);
+}
+
+inline bool HomographySampler::empty() const
+{
+	return _frame.empty();
+}
+
+template <typename FUN>
+inline void HomographySampler::sample(int x, int y, int w, int h, FUN fun) const
+{
+	const double* m = _inv;
+	for (int j = 0; j < h; ++j)
+	{
+		double X = m[0]*x + m[1]*(y+j) + m[2];
+		double Y = m[3]*x + m[4]*(y+j) + m[5];
+		double W = m[6]*x + m[7]*(y+j) + m[8];
+		for (int i = 0; i < w; ++i, X += m[0], Y += m[3], W += m[6])
+		{
+			double iw = W? 1.0/W : 0;
+			fun(i, j, X*iw, Y*iw);
+		}
+	}
+}
+
+inline const uint8_t* HomographySampler::at(int x, int y) const
+{
+	static const uint8_t black[4] = {};
+	if (x < 0 or y < 0 or x >= _frame.cols or y >= _frame.rows)
+		return black;
+	return _frame.ptr<uint8_t>(y) + x*_channels;
+}
+
+inline void HomographySampler::pixel(double sx, double sy, uint8_t* out) const
+{
+	// 5 bits of sub pixel position, like opencv
+	int fx = (int)std::lrint(std::clamp<double>(sx * 32, INT_MIN, INT_MAX));
+	int fy = (int)std::lrint(std::clamp<double>(sy * 32, INT_MIN, INT_MAX));
+	int ix = fx >> 5;
+	int iy = fy >> 5;
+	unsigned ax = fx & 31;
+	unsigned ay = fy & 31;
+
+	const uint8_t* p00 = at(ix, iy);
+	const uint8_t* p01 = at(ix+1, iy);
+	const uint8_t* p10 = at(ix, iy+1);
+	const uint8_t* p11 = at(ix+1, iy+1);
+	unsigned w00 = (32-ax)*(32-ay);
+	unsigned w01 = ax*(32-ay);
+	unsigned w10 = (32-ax)*ay;
+	unsigned w11 = ax*ay;
+
+	int channels = std::min(_channels, 3);
+	for (int c = 0; c < 3; ++c)
+	{
+		int ch = std::min(c, channels-1);
+		out[c] = (p00[ch]*w00 + p01[ch]*w01 + p10[ch]*w10 + p11[ch]*w11 + 512) >> 10;
+	}
+}
+
+inline cv::Mat HomographySampler::rgb(int x, int y, int w, int h) const
+{
+	cv::Mat out(h, w, CV_8UC3);
+	sample(x, y, w, h, [&] (int i, int j, double sx, double sy) {
+		pixel(sx, sy, out.ptr<uint8_t>(j) + i*3);
+	});
+	return out;
+}
+
+inline void HomographySampler::gray(int x, int y, int w, int h, uint8_t* out) const
+{
+	sample(x, y, w, h, [&] (int i, int j, double sx, double sy) {
+		uint8_t p[3];
+		pixel(sx, sy, p);
+		// RGB2GRAY's fixed point weights
+		out[j*w + i] = (p[0]*4899 + p[1]*9617 + p[2]*1868 + (1 << 13)) >> 14;
+	});
+}
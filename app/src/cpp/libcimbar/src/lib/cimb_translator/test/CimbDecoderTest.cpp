@@ -7,10 +7,12 @@
 #include "bit_file/bitbuffer.h"
 #include "bit_file/bitmatrix.h"
 #include "cimb_translator/Common.h"
+#include "image_hash/hamming_search.h"
 #include "serialize/format.h"
 #include <opencv2/opencv.hpp>
 
 #include <iostream>
+#include <random>
 #include <string>
 #include <vector>
 using std::string;
@@ -30,6 +32,18 @@ namespace {
 		bits |= cd.decode_color(tile8, 1) << cd.symbol_bits();
 		return bits;
 	}
+
+	// the same decoder, minus the SIMD
+	class ScalarCimbDecoder : public CimbDecoder
+	{
+	public:
+		using CimbDecoder::CimbDecoder;
+
+		void use_scalar()
+		{
+			_nearest = image_hash::nearest_scalar;
+		}
+	};
 }
 
 TEST_CASE( "CimbDecoderTest/testSimpleDecode", "[unit]" )
@@ -177,3 +191,64 @@ TEST_CASE( "CimbDecoderTest/test_decode_symbol_sloppy", "[unit]" )
 	assertEquals(7, drift_offset);
 	assertEquals(6, best_distance);
 }
+
+TEST_CASE( "CimbDecoderTest/testBestSymbolMatchesScalar", "[unit]" )
+{
+	// the vectorized tile search (and the hash index) have to pick exactly what the scalar one would -- ties, drift early exit and cooldown skip included
+	using result = image_hash::ahash_result<cimbar::Config::cell_size()>;
+	CimbDecoder cd(4, 2);
+	CimbDecoder indexed(4, 2, true, 0, true);
+	ScalarCimbDecoder scalar(4, 2);
+	scalar.use_scalar();
+
+	std::mt19937 gen(42);
+	unsigned checked = 0;
+	unsigned exact = 0;
+	for (unsigned sample = 0; sample < 2000; ++sample)
+	{
+		// a tile somewhere in the 10x10, then some noise. Or just noise
+		result::rows_type rows = {};
+		if (sample % 4 != 0)
+		{
+			cv::Mat tile = cimbar::getTile(4, gen() % 16, true);
+			cv::cvtColor(tile, tile, cv::COLOR_RGB2GRAY);
+			unsigned dx = gen() % 3;
+			unsigned dy = gen() % 3;
+			for (int y = 0; y < tile.rows; ++y)
+				for (int x = 0; x < tile.cols; ++x)
+					if (tile.at<uchar>(y, x) > 127)
+						rows[y+dy] |= 1 << (result::READLEN - 1 - x - dx);
+		}
+		unsigned flips = (sample % 4 == 0)? 100 : gen() % 8;
+		for (unsigned f = 0; f < flips; ++f)
+			rows[gen() % result::READLEN] ^= 1 << (gen() % result::READLEN);
+
+		for (unsigned mode : {result::FAST, result::ALL})
+			for (unsigned cooldown : {0xFFU, 0xFEU, 0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U})
+			{
+				result res(rows, mode);
+
+				unsigned drift = 99, distance = 99;
+				unsigned symbol = cd.get_best_symbol(res, drift, distance, cooldown);
+
+				unsigned expectedDrift = 99, expectedDistance = 99;
+				unsigned expected = scalar.get_best_symbol(res, expectedDrift, expectedDistance, cooldown);
+
+				assertEquals( expected, symbol );
+				assertEquals( expectedDrift, drift );
+				assertEquals( expectedDistance, distance );
+
+				drift = 99, distance = 99;
+				symbol = indexed.get_best_symbol(res, drift, distance, cooldown);
+				assertEquals( expected, symbol );
+				assertEquals( expectedDrift, drift );
+				assertEquals( expectedDistance, distance );
+				++checked;
+				exact += distance == 0;
+			}
+	}
+
+	// we did hit the early exit
+	assertTrue( exact > 0 );
+	assertEquals( 2000*2*11, checked );
+}
@@ -8,9 +8,12 @@
 #include "serialize/format.h"
 #include <opencv2/opencv.hpp>
 
+#include <functional>
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
+#include <vector>
 using std::string;
 
 namespace {
@@ -157,6 +160,111 @@ TEST_CASE( "CimbReaderTest/testSampleMessy", "[unit]" )
 	assertTrue(cr.done());
 }
 
+TEST_CASE( "CimbReaderTest/testDirect", "[unit]" )
+{
+	// with an identity transform, sampling the "frame" should be exactly the same as reading the image
+	cv::Mat sample = TestCimbar::loadSample("6bit/4_30_f0_627_extract.jpg");
+	cv::Mat identity = cv::Mat::eye(3, 3, CV_64F);
+
+	for (bool sharpen : {false, true})
+	{
+		CimbDecoder decoder(4, 2);
+		CimbReader expected(sample, decoder, 1, sharpen);
+		CimbReader direct(sample, identity, decoder, 1, sharpen);
+
+		int count = 0;
+		while (!expected.done())
+		{
+			PositionData pos;
+			unsigned bits = expected.read(pos);
+			unsigned colorBits = expected.read_color(pos);
+
+			PositionData dpos;
+			assertEquals( bits, direct.read(dpos) );
+			assertEquals( pos.i, dpos.i );
+			assertEquals( pos.x, dpos.x );
+			assertEquals( pos.y, dpos.y );
+			assertEquals( colorBits, direct.read_color(dpos) );
+			++count;
+		}
+		assertTrue( direct.done() );
+		assertEquals( 12400, count );
+	}
+}
+
+TEST_CASE( "CimbReaderTest/testParallel", "[unit]" )
+{
+	CimbDecoder decoder(4, 2);
+
+	// the clean sample gives us the right answers
+	std::map<unsigned, unsigned> expected;
+	{
+		CimbReader cr(TestCimbar::loadSample("6bit/4color_ecc30_fountain_0.png"), decoder, 1);
+		while (!cr.done())
+		{
+			PositionData pos;
+			unsigned bits = cr.read(pos);
+			expected[pos.i] = bits;
+		}
+	}
+
+	cv::Mat sample = TestCimbar::loadSample("6bit/4_30_f0_627_extract.jpg");
+	unsigned serialErrors = 0;
+	{
+		CimbReader cr(sample, decoder, 1);
+		while (!cr.done())
+		{
+			PositionData pos;
+			unsigned bits = cr.read(pos);
+			serialErrors += bits != expected[pos.i];
+		}
+	}
+
+	// real threads, the calling thread only, and a pool too busy to get to anything until we're done
+	std::vector<std::thread> threads;
+	std::vector<std::function<void()>> later;
+	std::vector<std::pair<CimbReader::executor, unsigned>> pools = {
+		{[&threads] (std::function<void()> fun) { threads.emplace_back(std::move(fun)); }, 3},
+		{[&threads] (std::function<void()> fun) { threads.emplace_back(std::move(fun)); }, 8},
+		{[] (std::function<void()> fun) { fun(); }, 3},
+		{[&later] (std::function<void()> fun) { later.push_back(std::move(fun)); }, 3},
+		{nullptr, 3},
+	};
+
+	std::vector<std::pair<PositionData, unsigned>> first;
+	for (auto&& [execute, helpers] : pools)
+	{
+		CimbReader cr(sample, decoder, 1);
+		std::vector<std::pair<PositionData, unsigned>> res = cr.read_parallel(execute, helpers);
+		for (std::thread& t : threads)
+			t.join();
+		threads.clear();
+		for (std::function<void()>& fun : later)
+			fun(); // nothing left for them
+		later.clear();
+
+		assertTrue( cr.done() );
+		assertEquals( 12400, res.size() );
+
+		// about as good as the serial flood...
+		unsigned errors = 0;
+		for (auto&& [pos, bits] : res)
+			errors += bits != expected[pos.i];
+		assertTrue( (errors <= serialErrors + 12) );
+
+		// ... and the same every time
+		if (first.empty())
+			first = res;
+		for (unsigned i = 0; i < res.size(); ++i)
+		{
+			assertEquals( first[i].first.i, res[i].first.i );
+			assertEquals( first[i].first.x, res[i].first.x );
+			assertEquals( first[i].first.y, res[i].first.y );
+			assertEquals( first[i].second, res[i].second );
+		}
+	}
+}
+
 TEST_CASE( "CimbReaderTest/testBad", "[unit]" )
 {
 	// this is a non-extracted image, and it's dimensions are too small.
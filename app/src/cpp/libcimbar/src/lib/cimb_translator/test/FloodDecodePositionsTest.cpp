@@ -128,3 +128,73 @@ TEST_CASE( "FloodDecodePositionsTest/testSimple", "[unit]" )
 	assertEquals(posCount, count);
 	assertEquals(0, remainingPos.size());
 }
+
+namespace {
+	// a stand in for the decode: the error and drift only depend on the cell
+	unsigned fake_error(unsigned i)
+	{
+		return (i * 2654435761U >> 7) % 9;
+	}
+
+	template <typename CURSOR>
+	void flood(CURSOR& cursor, std::vector<std::tuple<unsigned, int, int, unsigned>>& log)
+	{
+		while (!cursor.done())
+		{
+			auto [i, xy, drift, cooldown] = cursor.next();
+			log.push_back({i, drift.x(), drift.y(), cooldown});
+			if (fake_error(i) == 0)
+				drift.updateDrift(1, 0);
+			cursor.update(i, drift, fake_error(i), CellDrift::calculate_cooldown(cooldown, 4));
+		}
+	}
+}
+
+TEST_CASE( "FloodDecodePositionsTest/testRegions", "[unit]" )
+{
+	const unsigned posCount = 12400;
+
+	FloodDecodePositions cells(cimbar::vec_xy{9, 9}, cimbar::vec_xy{112, 112}, 8, cimbar::vec_xy{6, 6});
+	std::vector<FloodDecodePositions::region> regions = cells.split();
+	assertEquals( 8, regions.size() );
+
+	// each region only hands out its own cells
+	std::vector<std::vector<std::tuple<unsigned, int, int, unsigned>>> logs(regions.size());
+	for (int r = regions.size()-1; r >= 0; --r)
+	{
+		flood(regions[r], logs[r]);
+		assertFalse( logs[r].empty() );
+		for (auto&& [i, x, y, cooldown] : logs[r])
+			assertEquals( r, cells.owner(i) );
+	}
+
+	std::vector<std::tuple<unsigned, int, int, unsigned>> seam;
+	cells.merge(regions);
+	flood(cells, seam);
+	for (auto&& [i, x, y, cooldown] : seam)
+		assertEquals( FloodDecodePositions::SEAM, cells.owner(i) );
+
+	std::set<unsigned> seen;
+	for (const auto& log : logs)
+		for (auto&& [i, x, y, cooldown] : log)
+			seen.insert(i);
+	for (auto&& [i, x, y, cooldown] : seam)
+		seen.insert(i);
+	assertEquals( posCount, seen.size() );
+	assertTrue( cells.done() );
+
+	// the order regions run in doesn't matter
+	FloodDecodePositions again(cimbar::vec_xy{9, 9}, cimbar::vec_xy{112, 112}, 8, cimbar::vec_xy{6, 6});
+	std::vector<FloodDecodePositions::region> regions2 = again.split();
+	for (unsigned r = 0; r < regions2.size(); ++r)
+	{
+		std::vector<std::tuple<unsigned, int, int, unsigned>> log;
+		flood(regions2[r], log);
+		assertEquals( logs[r], log );
+	}
+
+	std::vector<std::tuple<unsigned, int, int, unsigned>> seam2;
+	again.merge(regions2);
+	flood(again, seam2);
+	assertEquals( seam, seam2 );
+}
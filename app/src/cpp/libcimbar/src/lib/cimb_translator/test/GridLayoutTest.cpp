@@ -0,0 +1,72 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "GridLayout.h"
+#include "AdjacentCellFinder.h"
+#include "CellPositions.h"
+#include "Config.h"
+#include "Interleave.h"
+#include "util/ConfigScope.h"
+
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+TEST_CASE( "GridLayoutTest/testTables", "[unit]" )
+{
+	GridLayout::params p{{9, 9}, {112, 112}, 8, {6, 6}, 155, 2};
+	GridLayout layout(p);
+	assertEquals( 12400, layout.size() );
+
+	CellPositions::positions_list positions = CellPositions::compute(p.spacing, p.dimensions, p.offset, p.marker_size);
+	assertEquals( positions, layout.positions() );
+
+	AdjacentCellFinder finder(positions, p.dimensions, p.marker_size);
+	for (unsigned i = 0; i < positions.size(); ++i)
+		assertEquals( finder.find(i), layout.adjacent(i) );
+
+	assertEquals( Interleave::interleave_reverse(positions.size(), 155, 2), layout.interleave_lookup() );
+	assertEquals( Interleave::interleave(positions, 155, 2), layout.interleaved_positions() );
+
+	// every seed owns itself
+	assertEquals( 8, layout.seeds().size() );
+	for (unsigned r = 0; r < layout.seeds().size(); ++r)
+		assertEquals( r, layout.owner(std::get<0>(layout.seeds()[r])) );
+}
+
+TEST_CASE( "GridLayoutTest/testNoInterleave", "[unit]" )
+{
+	GridLayout layout({{9, 9}, {112, 112}, 8, {6, 6}});
+	for (unsigned i = 0; i < layout.size(); ++i)
+		assertEquals( i, layout.interleave_lookup()[i] );
+	assertEquals( layout.positions(), layout.interleaved_positions() );
+}
+
+TEST_CASE( "GridLayoutTest/testShared", "[unit]" )
+{
+	std::shared_ptr<const GridLayout> layout = GridLayout::get();
+	assertEquals( layout, GridLayout::get() );
+	assertEquals( layout, GridLayout::get(0, cimbar::Config::interleave_blocks(), cimbar::Config::interleave_partitions()) );
+	assertEquals( cimbar::Config::cell_offset(), layout->positions()[0].second );
+
+	// padding moves the grid, so it's a different layout
+	std::shared_ptr<const GridLayout> padded = GridLayout::get(10);
+	assertFalse( layout == padded );
+	assertEquals( cimbar::Config::cell_offset() + 10, padded->positions()[0].second );
+
+	assertFalse( layout == GridLayout::get(0, 0, 1) );
+
+	// ... as is a different mode
+	{
+		ConfigScope cs(67);
+		std::shared_ptr<const GridLayout> mini = GridLayout::get();
+		assertFalse( layout == mini );
+		assertEquals( cimbar::Config::total_cells(), mini->size() );
+	}
+
+	// Config is per thread, but the layouts aren't
+	std::future<std::shared_ptr<const GridLayout>> other = std::async(std::launch::async, [] () { return GridLayout::get(); });
+	assertEquals( layout, other.get() );
+}
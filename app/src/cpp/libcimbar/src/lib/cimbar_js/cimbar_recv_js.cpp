@@ -5,6 +5,9 @@
 #include "compression/zstd_header_check.h"
 #include "encoder/Decoder.h"
 #include "encoder/escrow_buffer_writer.h"
+#include "extractor/AnchorTracker.h"
+#include "extractor/Corners.h"
+#include "extractor/Deskewer.h"
 #include "extractor/Extractor.h"
 #include "fountain/fountain_decoder_sink.h"
 #include "serialize/str_join.h"
@@ -31,6 +34,9 @@ namespace {
 	std::string _reporting;
 	cv::Mat _debugFrame;
 
+	// consecutive frames mostly skip the full scan
+	AnchorTracker _tracker;
+
 	TimeAccumulator _tScanExtract;
 	TimeAccumulator _tImgDecode;
 
@@ -93,31 +99,45 @@ namespace {
 
 	cv::UMat get_rgb(void* imgdata, int width, int height, int type)
 	{
+		// (YUV frames don't come through here. See extract_yuv())
 		cv::UMat img;
-		switch (type)
-		{
-			case 12:
-			{
-				img = cv::Mat(height * 3/2, width, CV_8UC1, imgdata).getUMat(cv::ACCESS_RW).clone();
-				cv::cvtColor(img, img, cv::COLOR_YUV2RGB_NV12); // 12 or 21 :hmm:
-				return img;
-			}
-			case 420:
-			{
-				img = cv::Mat(height * 3/2, width, CV_8UC1, imgdata).getUMat(cv::ACCESS_RW).clone();
-				cv::cvtColor(img, img, cv::COLOR_YUV420p2RGB);
-				return img;
-			}
-			default:
-				break;
-		}
-
 		int cvtype = type==4? CV_8UC4 : CV_8UC3;
 		img = cv::Mat(height, width, cvtype, imgdata).getUMat(cv::ACCESS_RW).clone();
 		if (type == 4)
 			cv::cvtColor(img, img, cv::COLOR_RGBA2RGB);
 		return img;
 	}
+
+	bool is_yuv420(int type)
+	{
+		return type == 12 or type == 420;
+	}
+
+	// for YUV frames: scan on the luma plane as-is, and only convert the deskewed image to RGB.
+	// most frames don't have a barcode in them, so most frames never get converted at all.
+	int extract_yuv(const uchar* imgdata, int width, int height, int type, cv::Mat& out)
+	{
+		cv::Mat luma(height, width, CV_8UC1, (void*)imgdata);
+		std::vector<Anchor> anchors = _tracker.scan(luma);
+		if (anchors.size() < 4)
+			return Extractor::FAILURE;
+
+		Corners corners(anchors);
+		Deskewer de;
+		uchar* chroma = const_cast<uchar*>(imgdata) + (width * height);
+		if (type == 420)
+		{
+			cv::Mat u(height/2, width/2, CV_8UC1, chroma);
+			cv::Mat v(height/2, width/2, CV_8UC1, chroma + (width/2) * (height/2));
+			out = de.deskew_i420(luma, u, v, corners);
+		}
+		else
+			out = de.deskew_nv12(luma, cv::Mat(height/2, width/2, CV_8UC2, chroma), corners);
+
+		if ( !corners.is_granular_scale({cimbar::Config::image_size_x(), cimbar::Config::image_size_y()}) )
+			return Extractor::NEEDS_SHARPEN;
+		return Extractor::SUCCESS;
+	}
 }
 
 extern "C" {
@@ -160,31 +180,46 @@ int cimbard_scan_extract_decode(const uchar* imgdata, unsigned imgw, unsigned im
 
 	// interface to take the aligned output buffers of chunkSize and dump them into bufspace
 	escrow_buffer_writer ebw(bufspace, chunksPerFrame, chunkSize);
-	Extractor ext;
 	Decoder dec;
 
-	cv::UMat img = get_rgb((void*)imgdata, imgw, imgh, format);
-	_debugFrame = img.getMat(cv::ACCESS_READ).clone();
-
 	_reporting = fmt::format("sce: {}, imgdec: {}", _tScanExtract.avg(), _tImgDecode.avg());
 
 	bool shouldPreprocess = true;
+	int bytes = 0;
+	if (is_yuv420(format))
 	{
-		Timer t(_tScanExtract);
-		int res = ext.extract(img, img);
-		if (!res)
-			return -3;
-		else if (res == Extractor::NEEDS_SHARPEN)
-			shouldPreprocess = true;
-	}
+		cv::Mat img;
+		{
+			Timer t(_tScanExtract);
+			int res = extract_yuv(imgdata, imgw, imgh, format, img);
+			if (!res)
+				return -3;
+		}
+		// the full frame was never converted, so the debug frame is the deskewed one
+		_debugFrame = img;
 
-	// decode
-	int bytes = 0;
+		Timer t(_tImgDecode);
+		dec.decode_fountain(img, ebw, shouldPreprocess);
+	}
+	else
 	{
+		Extractor ext;
+		cv::UMat img = get_rgb((void*)imgdata, imgw, imgh, format);
+		_debugFrame = img.getMat(cv::ACCESS_READ).clone();
+		{
+			Timer t(_tScanExtract);
+			int res = ext.extract(img, img, _tracker);
+			if (!res)
+				return -3;
+			else if (res == Extractor::NEEDS_SHARPEN)
+				shouldPreprocess = true;
+		}
+
 		Timer t(_tImgDecode);
 		dec.decode_fountain(img, ebw, shouldPreprocess);
 	}
-	_reporting = fmt::format("sce: {}, imgdec: {}, decoded {} bytes!!! {}", _tScanExtract.avg(), _tImgDecode.avg(), bytes, ebw.buffers_in_use() * chunkSize);
+	_reporting = fmt::format("sce: {} (tracked {}/{}), imgdec: {}, decoded {} bytes!!! {}", _tScanExtract.avg(), _tracker.tracked(),
+							 _tracker.tracked() + _tracker.full_scans(), _tImgDecode.avg(), bytes, ebw.buffers_in_use() * chunkSize);
 	return ebw.buffers_in_use() * chunkSize;
 }
 
@@ -282,6 +317,7 @@ int cimbard_configure_decode(int mode_val)
 		_modeVal = mode_val;
 		cimbar::Config::update(mode_val);
 		_sink.reset();
+		_tracker.reset();
 	}
 
 	return 0;
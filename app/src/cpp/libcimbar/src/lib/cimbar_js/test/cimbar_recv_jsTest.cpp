@@ -138,3 +138,35 @@ TEST_CASE( "cimbar_recv_jsTest/testFullDecode", "[unit]" )
 
 }
 
+
+TEST_CASE( "cimbar_recv_jsTest/testYuvFrames", "[unit]" )
+{
+	std::vector<unsigned char> buff;
+	buff.resize(cimbard_get_bufsize());
+
+	cv::Mat img = TestCimbar::loadSample("b/4cecc30f.png");
+
+	// planar
+	cv::Mat i420;
+	cv::cvtColor(img, i420, cv::COLOR_RGB2YUV_I420);
+	int bytes = cimbard_scan_extract_decode(i420.data, img.cols, img.rows, 420, buff.data(), buff.size());
+	assertEquals(bytes, 7500);
+
+	// interleaved chroma
+	cv::Mat nv12 = i420.clone();
+	unsigned planeSize = (img.cols/2) * (img.rows/2);
+	unsigned char* u = i420.data + (img.cols * img.rows);
+	unsigned char* v = u + planeSize;
+	unsigned char* uv = nv12.data + (img.cols * img.rows);
+	for (unsigned i = 0; i < planeSize; ++i)
+	{
+		uv[i*2] = u[i];
+		uv[i*2 + 1] = v[i];
+	}
+	bytes = cimbard_scan_extract_decode(nv12.data, img.cols, img.rows, 12, buff.data(), buff.size());
+	assertEquals(bytes, 7500);
+
+	// no barcode, no luck
+	cv::Mat blank(img.rows * 3/2, img.cols, CV_8UC1, cv::Scalar(128));
+	assertEquals( -3, cimbard_scan_extract_decode(blank.data, img.cols, img.rows, 12, buff.data(), buff.size()) );
+}
@@ -1,22 +1,28 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "aligned_stream.h"
 #include "reed_solomon_stream.h"
 #include "bit_file/bitbuffer.h"
 #include "cimb_translator/CimbDecoder.h"
 #include "cimb_translator/CimbReader.h"
 #include "cimb_translator/Config.h"
-#include "cimb_translator/Interleave.h"
+#include "cimb_translator/GridLayout.h"
 #include "util/null_stream.h"
+#include "util/stage_metrics.h"
 
 #include <opencv2/opencv.hpp>
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 class Decoder
 {
 public:
-	Decoder(bool use_ecc=true, bool interleave=true);
+	// with a flood_pool, each frame's symbols are read on this thread plus up to flood_helpers of the pool's.
+	// the pool is the caller's, and should outlive us. See CimbReader::read_parallel()
+	Decoder(bool use_ecc=true, bool interleave=true, CimbReader::executor flood_pool=nullptr, unsigned flood_helpers=0);
 
 	template <typename MAT, typename STREAM>
 	unsigned decode(const MAT& img, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
@@ -24,22 +30,63 @@ public:
 	template <typename MAT, typename STREAM>
 	unsigned decode_fountain(const MAT& img, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
 
+	// same, but reading the cells straight off the camera frame. transform is from Extractor::extract_transform()
+	template <typename STREAM>
+	unsigned decode_fountain_direct(const cv::Mat& frame, const cv::Mat& transform, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
+
+	// decode_fountain(), in two halves that can run on different threads. Each needs the frame's Config::update() on its thread.
+	template <typename STREAM>
+	struct fountain_frame
+	{
+		fountain_frame(const cv::Mat& img, CimbDecoder& decoder, STREAM& ostream, bool should_preprocess, int color_correction);
+
+		CimbReader reader;
+		aligned_stream<STREAM> aligner;
+		std::vector<PositionData> colorPositions;
+		bitbuffer bb;
+	};
+
+	// null if there's nothing left for the colors half (e.g. a chunk size mismatch, which we decode in one go)
+	template <typename STREAM>
+	std::shared_ptr<fountain_frame<STREAM>> decode_fountain_symbols(const cv::Mat& img, STREAM& ostream, unsigned& bytes, bool should_preprocess=false, int color_correction=2);
+
+	template <typename STREAM>
+	unsigned decode_fountain_colors(fountain_frame<STREAM>& frame);
+
 protected:
 	template <typename STREAM>
 	unsigned do_decode(CimbReader& reader, STREAM& ostream);
 
+	template <typename FOUNTAINSTREAM>
+	unsigned do_decode_fountain(CimbReader& reader, FOUNTAINSTREAM& ostream);
+
 	template <typename STREAM>
-	unsigned do_decode_coupled(CimbReader& reader, STREAM& ostream);
+	void do_decode_symbols(CimbReader& reader, STREAM& ostream, std::vector<PositionData>& colorPositions, bitbuffer& bb);
+
+	template <typename STREAM>
+	unsigned do_decode_colors(CimbReader& reader, STREAM& ostream, const std::vector<PositionData>& colorPositions, bitbuffer& bb);
+
+	void do_decode_coupled_symbols(CimbReader& reader, std::vector<PositionData>& colorPositions, bitbuffer& bb);
+
+	template <typename FUN>
+	void read_symbols(CimbReader& reader, FUN&& fun);
+
+	template <typename STREAM>
+	unsigned do_decode_coupled_colors(CimbReader& reader, STREAM& ostream, const std::vector<PositionData>& colorPositions, bitbuffer& bb);
 
 protected:
 	bool _useEcc;
 	bool _interleave;
+	CimbReader::executor _floodPool;
+	unsigned _floodHelpers;
 	CimbDecoder _decoder;
 };
 
-inline Decoder::Decoder(bool use_ecc, bool interleave)
+inline Decoder::Decoder(bool use_ecc, bool interleave, CimbReader::executor flood_pool, unsigned flood_helpers)
 	: _useEcc(use_ecc)
 	, _interleave(interleave)
+	, _floodPool(std::move(flood_pool))
+	, _floodHelpers(flood_helpers)
 	, _decoder(cimbar::Config::symbol_bits(), cimbar::Config::color_bits(), cimbar::Config::dark(), 0xFF)
 {
 }
@@ -58,9 +105,18 @@ inline Decoder::Decoder(bool use_ecc, bool interleave)
  * */
 template <typename STREAM>
 inline unsigned Decoder::do_decode(CimbReader& reader, STREAM& ostream)
+{
+	std::vector<PositionData> colorPositions;
+	bitbuffer bb;
+	do_decode_symbols(reader, ostream, colorPositions, bb);
+	return do_decode_colors(reader, ostream, colorPositions, bb);
+}
+
+template <typename STREAM>
+inline void Decoder::do_decode_symbols(CimbReader& reader, STREAM& ostream, std::vector<PositionData>& colorPositions, bitbuffer& bb)
 {
 	if (cimbar::Config::legacy_mode())
-		return do_decode_coupled(reader, ostream);
+		return do_decode_coupled_symbols(reader, colorPositions, bb);
 
 	unsigned eccBytes = _useEcc? cimbar::Config::ecc_bytes() : 0;
 	unsigned eccBlockSize = cimbar::Config::ecc_block_size();
@@ -70,46 +126,60 @@ inline unsigned Decoder::do_decode(CimbReader& reader, STREAM& ostream)
 
 	unsigned bitsPerSymbol = cimbar::Config::symbol_bits();
 	unsigned symCapacity = cimbar::Config::capacity(bitsPerSymbol);
-	unsigned colorCapacity = cimbar::Config::capacity(colorBits);
-	unsigned bitsPerOp = cimbar::Config::bits_per_cell();
-	unsigned fountain_chunks_per_frame = cimbar::Config::fountain_chunks_per_frame(bitsPerOp);
 
-	std::vector<unsigned> interleaveLookup = Interleave::interleave_reverse(reader.num_reads(), interleaveBlocks, interleavePartitions);
-	std::vector<PositionData> colorPositions;
+	std::shared_ptr<const GridLayout> layout = reader.layout(interleaveBlocks, interleavePartitions);
+	const std::vector<unsigned>& interleaveLookup = layout->interleave_lookup();
 	colorPositions.resize(reader.num_reads()); // the number of cells == reader.num_reads(). Can we calculate this from config at compile time? Do we care?
 
+	bitbuffer symbolBuff(symCapacity);
+	// read symbols first
 	{
-		bitbuffer symbolBuff(symCapacity);
-		// read symbols first
-		while (!reader.done())
-		{
-			// reader is in charge of the cell index (i) calculation
-			// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
-			PositionData pos;
-			unsigned bits = reader.read(pos);
-
+		stage_timer t(stage_metrics::SYMBOL_DECODE);
+		// reader is in charge of the cell index (i) calculation
+		// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
+		read_symbols(reader, [&] (const PositionData& pos, unsigned bits) {
 			unsigned bitPos = interleaveLookup[pos.i] * bitsPerSymbol; // bitspersymbol, *iff* we're in the new mode
 			symbolBuff.write(bits, bitPos, bitsPerSymbol);
 
 			// TODO: simplify this function by not storing colorPositions?
-			// this is how it was originally done (see `do_decode_coupled()`), but we should be able to calculate them on the fly now
+			// this is how it was originally done (see `do_decode_coupled_symbols()`), but we should be able to calculate them on the fly now
 			colorPositions[pos.i] = {interleaveLookup[pos.i] * colorBits, pos.x, pos.y};
-		}
-
-		// flush symbols
-		reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
-		symbolBuff.flush(rss);
+		});
 	}
 
-	// do color correction init, now that we (hopefully) have some fountain headers from the symbol decode
-	reader.init_ccm(colorBits, interleaveBlocks, interleavePartitions, fountain_chunks_per_frame);
+	// flush symbols
+	reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
+	symbolBuff.flush(rss);
+}
+
+template <typename STREAM>
+inline unsigned Decoder::do_decode_colors(CimbReader& reader, STREAM& ostream, const std::vector<PositionData>& colorPositions, bitbuffer& bb)
+{
+	if (cimbar::Config::legacy_mode())
+		return do_decode_coupled_colors(reader, ostream, colorPositions, bb);
+
+	unsigned eccBytes = _useEcc? cimbar::Config::ecc_bytes() : 0;
+	unsigned eccBlockSize = cimbar::Config::ecc_block_size();
+	unsigned colorBits = cimbar::Config::color_bits();
+	unsigned interleaveBlocks = _interleave? cimbar::Config::interleave_blocks() : 0;
+	unsigned interleavePartitions = cimbar::Config::interleave_partitions();
+
+	unsigned colorCapacity = cimbar::Config::capacity(colorBits);
+	unsigned bitsPerOp = cimbar::Config::bits_per_cell();
+	unsigned fountain_chunks_per_frame = cimbar::Config::fountain_chunks_per_frame(bitsPerOp);
 
 	bitbuffer colorBuff(colorCapacity);
-	// then decode colors.
-	for (const PositionData& p : colorPositions)
 	{
-		unsigned bits = reader.read_color(p);
-		colorBuff.write(bits, p.i, colorBits);
+		stage_timer t(stage_metrics::COLOR_DECODE);
+		// do color correction init, now that we (hopefully) have some fountain headers from the symbol decode
+		reader.init_ccm(colorBits, interleaveBlocks, interleavePartitions, fountain_chunks_per_frame);
+
+		// then decode colors.
+		for (const PositionData& p : colorPositions)
+		{
+			unsigned bits = reader.read_color(p);
+			colorBuff.write(bits, p.i, colorBits);
+		}
 	}
 
 	reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
@@ -117,43 +187,65 @@ inline unsigned Decoder::do_decode(CimbReader& reader, STREAM& ostream)
 	return colorBuff.flush(rss);
 }
 
-template <typename STREAM>
-inline unsigned Decoder::do_decode_coupled(CimbReader& reader, STREAM& ostream)
+// the legacy decoder. Symbol and color bits are grouped together (an individual cell is treated as ex:6 bits),
+// and the decode is done in two passes only for performance benefits (caching).
+inline void Decoder::do_decode_coupled_symbols(CimbReader& reader, std::vector<PositionData>& colorPositions, bitbuffer& bb)
 {
-	// the legacy decoder function. Symbol and color bits are grouped together (an individual cell is treated as ex:6 bits),
-	// and the decode is done in two passes only for performance benefits (caching).
-	unsigned eccBytes = _useEcc? cimbar::Config::ecc_bytes() : 0;
-	unsigned eccBlockSize = cimbar::Config::ecc_block_size();
-	unsigned colorBits = cimbar::Config::color_bits();
 	unsigned bitsPerOp = cimbar::Config::bits_per_cell();
 	unsigned interleaveBlocks = _interleave? cimbar::Config::interleave_blocks() : 0;
 	unsigned interleavePartitions = cimbar::Config::interleave_partitions();
 
-	bitbuffer bb(cimbar::Config::capacity(bitsPerOp));
-	std::vector<unsigned> interleaveLookup = Interleave::interleave_reverse(reader.num_reads(), interleaveBlocks, interleavePartitions);
-	std::vector<PositionData> colorPositions;
+	bb = bitbuffer(cimbar::Config::capacity(bitsPerOp));
+	std::shared_ptr<const GridLayout> layout = reader.layout(interleaveBlocks, interleavePartitions);
+	const std::vector<unsigned>& interleaveLookup = layout->interleave_lookup();
 	colorPositions.resize(reader.num_reads());
 
 	// read symbols first
-	while (!reader.done())
-	{
-		// reader is in charge of the cell index (i) calculation
-		// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
-		PositionData pos;
-		unsigned bits = reader.read(pos);
-
+	stage_timer t(stage_metrics::SYMBOL_DECODE);
+	// reader is in charge of the cell index (i) calculation
+	// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
+	read_symbols(reader, [&] (const PositionData& pos, unsigned bits) {
 		unsigned bitPos = interleaveLookup[pos.i] * bitsPerOp;
 		bb.write(bits, bitPos, bitsPerOp);
 
 		colorPositions[pos.i] = {bitPos, pos.x, pos.y};
+	});
+}
+
+template <typename FUN>
+inline void Decoder::read_symbols(CimbReader& reader, FUN&& fun)
+{
+	if (_floodPool and _floodHelpers)
+	{
+		for (auto&& [pos, bits] : reader.read_parallel(_floodPool, _floodHelpers))
+			fun(pos, bits);
+		return;
 	}
 
+	while (!reader.done())
+	{
+		PositionData pos;
+		unsigned bits = reader.read(pos);
+		fun(pos, bits);
+	}
+}
+
+template <typename STREAM>
+inline unsigned Decoder::do_decode_coupled_colors(CimbReader& reader, STREAM& ostream, const std::vector<PositionData>& colorPositions, bitbuffer& bb)
+{
+	unsigned eccBytes = _useEcc? cimbar::Config::ecc_bytes() : 0;
+	unsigned eccBlockSize = cimbar::Config::ecc_block_size();
+	unsigned colorBits = cimbar::Config::color_bits();
+
 	// then decode colors.
 	// the symbol+color decode could be done as one pass, but doing it as two gives us better cache utilization
-	for (const PositionData& p : colorPositions)
 	{
-		unsigned bits = reader.read_color(p);
-		bb.write(bits, p.i, colorBits);
+		stage_timer t(stage_metrics::COLOR_DECODE);
+		for (const PositionData& p : colorPositions)
+		{
+			unsigned bits = reader.read_color(p);
+			bb.write(bits, p.i, colorBits);
+		}
 	}
 
 	reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
@@ -171,6 +263,19 @@ template <typename MAT, typename FOUNTAINSTREAM>
 inline unsigned Decoder::decode_fountain(const MAT& img, FOUNTAINSTREAM& ostream, bool should_preprocess, int color_correction)
 {
 	CimbReader reader(img, _decoder, cimbar::Config::color_mode(), should_preprocess, color_correction);
+	return do_decode_fountain(reader, ostream);
+}
+
+template <typename FOUNTAINSTREAM>
+inline unsigned Decoder::decode_fountain_direct(const cv::Mat& frame, const cv::Mat& transform, FOUNTAINSTREAM& ostream, bool should_preprocess, int color_correction)
+{
+	CimbReader reader(frame, transform, _decoder, cimbar::Config::color_mode(), should_preprocess, color_correction);
+	return do_decode_fountain(reader, ostream);
+}
+
+template <typename FOUNTAINSTREAM>
+inline unsigned Decoder::do_decode_fountain(CimbReader& reader, FOUNTAINSTREAM& ostream)
+{
 	unsigned chunk_size = cimbar::Config::fountain_chunk_size();
 	auto update_md_fun = std::bind(&CimbReader::update_metadata, &reader, std::placeholders::_1, std::placeholders::_2, chunk_size);
 
@@ -187,3 +292,32 @@ inline unsigned Decoder::decode_fountain(const MAT& img, FOUNTAINSTREAM& ostream
 	aligned_stream aligner(ostream, ostream.chunk_size(), 0, update_md_fun);
 	return do_decode(reader, aligner);
 }
+
+template <typename STREAM>
+inline Decoder::fountain_frame<STREAM>::fountain_frame(const cv::Mat& img, CimbDecoder& decoder, STREAM& ostream, bool should_preprocess, int color_correction)
+	: reader(img, decoder, cimbar::Config::color_mode(), should_preprocess, color_correction)
+	, aligner(ostream, ostream.chunk_size(), 0, std::bind(&CimbReader::update_metadata, &reader, std::placeholders::_1, std::placeholders::_2, ostream.chunk_size()))
+{
+}
+
+template <typename STREAM>
+inline std::shared_ptr<Decoder::fountain_frame<STREAM>> Decoder::decode_fountain_symbols(const cv::Mat& img, STREAM& ostream, unsigned& bytes, bool should_preprocess, int color_correction)
+{
+	if (ostream.chunk_size() != cimbar::Config::fountain_chunk_size())
+	{
+		bytes = decode_fountain(img, ostream, should_preprocess, color_correction);
+		return nullptr;
+	}
+
+	auto frame = std::make_shared<fountain_frame<STREAM>>(img, _decoder, ostream, should_preprocess, color_correction);
+	do_decode_symbols(frame->reader, frame->aligner, frame->colorPositions, frame->bb);
+	bytes = frame->aligner.tellp();
+	return frame;
+}
+
+template <typename STREAM>
+inline unsigned Decoder::decode_fountain_colors(fountain_frame<STREAM>& frame)
+{
+	frame.reader.init_simple_ccm();
+	return do_decode_colors(frame.reader, frame.aligner, frame.colorPositions, frame.bb);
+}
@@ -3,6 +3,8 @@
 
 #include "ReedSolomon.h"
 #include "encoder/aligned_stream.h"
+#include "util/stage_metrics.h"
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -62,9 +64,14 @@ public:
 		}
 
 		// else
+		// only the decode itself counts toward REED_SOLOMON -- the downstream writes are timed by whoever is downstream
+		std::chrono::steady_clock::duration decodeTime(0);
 		while (length >= _buffer.size())
 		{
+			auto start = std::chrono::steady_clock::now();
 			ssize_t bytes = _rs.decode(data, _buffer.size(), _buffer.data());
+			decodeTime += std::chrono::steady_clock::now() - start;
+
 			if (bytes <= 0)
 				_stream << ReedSolomon::BadChunk(_buffer.size() - _rs.parity());
 			else
@@ -73,6 +80,7 @@ public:
 			length -= _buffer.size();
 			data += _buffer.size();
 		}
+		stage_metrics::global().record(stage_metrics::REED_SOLOMON, std::chrono::duration_cast<std::chrono::microseconds>(decodeTime).count());
 		return *this;
 	}
 
@@ -0,0 +1,131 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "Anchor.h"
+#include "Scanner.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// between two camera frames, the barcode hardly moves.
+// so once we've found all 4 anchors, look for them again in small windows around where they were,
+// and only go back to a full scan after a miss.
+// safe to share between threads -- frames that finish out of order just hand over slightly stale hints.
+class AnchorTracker
+{
+public:
+	AnchorTracker(bool fast=true, bool dark=true);
+
+	// full_scan is any callable taking the image and returning a vector<Anchor>. e.g. Scanner::scan_pyramid
+	template <typename MAT, typename FULLSCAN>
+	std::vector<Anchor> scan(const MAT& img, FULLSCAN full_scan);
+
+	template <typename MAT>
+	std::vector<Anchor> scan(const MAT& img);
+
+	void reset();
+	bool tracking() const;
+
+	uint64_t tracked() const;
+	uint64_t full_scans() const;
+
+protected:
+	template <typename MAT>
+	bool track(const MAT& img, std::vector<Anchor>& anchors) const;
+
+	void update(const std::vector<Anchor>& anchors, int cols, int rows);
+
+protected:
+	bool _fast;
+	bool _dark;
+
+	mutable std::mutex _mutex;
+	std::vector<Anchor> _last;
+	int _cols = 0;
+	int _rows = 0;
+
+	std::atomic<uint64_t> _tracked;
+	std::atomic<uint64_t> _fullScans;
+};
+
+inline AnchorTracker::AnchorTracker(bool fast, bool dark)
+	: _fast(fast)
+	, _dark(dark)
+	, _tracked(0)
+	, _fullScans(0)
+{
+}
+
+template <typename MAT, typename FULLSCAN>
+inline std::vector<Anchor> AnchorTracker::scan(const MAT& img, FULLSCAN full_scan)
+{
+	std::vector<Anchor> anchors;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_cols == img.cols and _rows == img.rows)
+			anchors = _last;
+	}
+
+	if (anchors.size() >= 4 and track(img, anchors))
+	{
+		++_tracked;
+		update(anchors, img.cols, img.rows);
+		return anchors;
+	}
+
+	++_fullScans;
+	anchors = full_scan(img);
+	update(anchors, img.cols, img.rows);
+	return anchors;
+}
+
+template <typename MAT>
+inline std::vector<Anchor> AnchorTracker::scan(const MAT& img)
+{
+	return scan(img, [this] (const MAT& im) { return Scanner(im, _fast, _dark).scan(); });
+}
+
+template <typename MAT>
+inline bool AnchorTracker::track(const MAT& img, std::vector<Anchor>& anchors) const
+{
+	// an anchor's width of slack on every side. If any of them slipped out of its window, we've lost the lock.
+	for (unsigned i = 0; i < anchors.size(); ++i)
+		if (!Scanner::scan_window(img, anchors[i], i < 3, anchors[i].max_range(), _fast, _dark))
+			return false;
+	return true;
+}
+
+inline void AnchorTracker::update(const std::vector<Anchor>& anchors, int cols, int rows)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (anchors.size() < 4)
+		_last.clear();
+	else
+		_last = anchors;
+	_cols = cols;
+	_rows = rows;
+}
+
+inline void AnchorTracker::reset()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_last.clear();
+}
+
+inline bool AnchorTracker::tracking() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _last.size() >= 4;
+}
+
+inline uint64_t AnchorTracker::tracked() const
+{
+	return _tracked;
+}
+
+inline uint64_t AnchorTracker::full_scans() const
+{
+	return _fullScans;
+}
@@ -0,0 +1,204 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "Corners.h"
+#include "Deskewer.h"
+#include "DistortionParameters.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// with the phone on a stand, the corners hardly move from frame to frame -- so neither does the deskew transform.
+// once the corners hold still for two frames in a row, we turn the transform into fixed point remap tables (which is what
+// warpPerspective rebuilds internally on every call), and keep reusing them until a corner moves more than `tolerance` pixels.
+// with distortion params set, the maps also undo the lens distortion -- so undistort + deskew is one resample of just the output grid.
+// safe to share between threads.
+class DeskewCache
+{
+public:
+	DeskewCache(unsigned tolerance=1);
+
+	// de is the deskew we would have done. Its geometry is part of the key, so a mode change is a miss.
+	template <typename MAT>
+	MAT deskew(const MAT& img, const Corners& corners, const Deskewer& de=Deskewer());
+
+	// corners passed to deskew() are then in undistorted coordinates. see Undistort::undistort_corners()
+	void set_distortion(const DistortionParameters& params);
+	void reset();
+
+	uint64_t hits() const;
+	uint64_t misses() const;
+	double hit_rate() const;
+
+protected:
+	struct entry
+	{
+		Corners corners;
+		std::vector<cv::Point2f> outputPoints;
+		cv::Size size;
+		cv::Mat map1;
+		cv::Mat map2;
+	};
+
+	bool matches(const entry& e, const Corners& corners, const Deskewer& de) const;
+	static std::shared_ptr<entry> build(const Corners& corners, const Deskewer& de, const DistortionParameters& distortion);
+
+protected:
+	unsigned _tolerance;
+
+	mutable std::mutex _mutex;
+	std::shared_ptr<const entry> _cached;
+	std::shared_ptr<const entry> _last; // the last miss. No maps, just the geometry
+	DistortionParameters _distortion;
+
+	std::atomic<uint64_t> _hits;
+	std::atomic<uint64_t> _misses;
+};
+
+inline DeskewCache::DeskewCache(unsigned tolerance)
+	: _tolerance(tolerance)
+	, _hits(0)
+	, _misses(0)
+{
+}
+
+template <typename MAT>
+inline MAT DeskewCache::deskew(const MAT& img, const Corners& corners, const Deskewer& de)
+{
+	std::shared_ptr<const entry> hit;
+	DistortionParameters distortion;
+	bool stable = false;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		distortion = _distortion;
+		if (_cached and matches(*_cached, corners, de))
+			hit = _cached;
+		else
+		{
+			stable = _last and matches(*_last, corners, de);
+			_last = std::make_shared<entry>(entry{corners, de.output_points(), de.output_size(), {}, {}});
+		}
+	}
+
+	if (!hit)
+	{
+		++_misses;
+		// a one-off: building the maps costs more than the warp. Unless there's distortion to undo -- then the maps are the only way.
+		if (!stable and !distortion)
+			return de.deskew(img, corners);
+
+		hit = build(corners, de, distortion);
+		std::lock_guard<std::mutex> lock(_mutex);
+		_cached = hit;
+	}
+	else
+		++_hits;
+
+	MAT output;
+	cv::remap(img, output, hit->map1, hit->map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+	return output;
+}
+
+inline bool DeskewCache::matches(const entry& e, const Corners& corners, const Deskewer& de) const
+{
+	if (e.size != de.output_size() or e.outputPoints != de.output_points())
+		return false;
+
+	auto close = [this] (const point<int>& a, const point<int>& b) {
+		return (unsigned)std::abs(a.x() - b.x()) <= _tolerance and (unsigned)std::abs(a.y() - b.y()) <= _tolerance;
+	};
+	return close(e.corners.top_left(), corners.top_left()) and close(e.corners.top_right(), corners.top_right())
+		and close(e.corners.bottom_left(), corners.bottom_left()) and close(e.corners.bottom_right(), corners.bottom_right());
+}
+
+inline std::shared_ptr<DeskewCache::entry> DeskewCache::build(const Corners& corners, const Deskewer& de, const DistortionParameters& distortion)
+{
+	auto e = std::make_shared<entry>(entry{corners, de.output_points(), de.output_size(), {}, {}});
+
+	// output pixel -> (undistorted) source pixel
+	cv::Mat inv = de.get_transform(corners).inv();
+	const double* m = inv.ptr<double>(0);
+
+	// undistorted pixel -> distorted pixel: the same model initUndistortRectifyMap uses (up to 8 coefficients)
+	double fx = 1, fy = 1, cx = 0, cy = 0;
+	std::array<double, 8> k = {};
+	if (distortion)
+	{
+		cv::Mat cam, coeffs;
+		distortion.camera.convertTo(cam, CV_64F);
+		distortion.distortion.convertTo(coeffs, CV_64F);
+		fx = cam.at<double>(0, 0);
+		fy = cam.at<double>(1, 1);
+		cx = cam.at<double>(0, 2);
+		cy = cam.at<double>(1, 2);
+		const double* c = coeffs.ptr<double>(0);
+		for (unsigned i = 0; i < std::min<size_t>(coeffs.total(), k.size()); ++i)
+			k[i] = c[i];
+	}
+
+	cv::Mat map(e->size, CV_32FC2);
+	for (int y = 0; y < map.rows; ++y)
+	{
+		float* p = map.ptr<float>(y);
+		for (int x = 0; x < map.cols; ++x, p += 2)
+		{
+			double w = m[6]*x + m[7]*y + m[8];
+			w = w? 1.0/w : 0;
+			double sx = (m[0]*x + m[1]*y + m[2]) * w;
+			double sy = (m[3]*x + m[4]*y + m[5]) * w;
+			if (distortion)
+			{
+				double u = (sx - cx) / fx;
+				double v = (sy - cy) / fy;
+				double r2 = u*u + v*v;
+				double radial = (1 + r2*(k[0] + r2*(k[1] + r2*k[4]))) / (1 + r2*(k[5] + r2*(k[6] + r2*k[7])));
+				sx = fx * (u*radial + 2*k[2]*u*v + k[3]*(r2 + 2*u*u)) + cx;
+				sy = fy * (v*radial + k[2]*(r2 + 2*v*v) + 2*k[3]*u*v) + cy;
+			}
+			p[0] = (float)sx;
+			p[1] = (float)sy;
+		}
+	}
+
+	// integer coordinates + an index into the interpolation table: the same 1/32 pixel steps warpPerspective uses
+	cv::convertMaps(map, cv::noArray(), e->map1, e->map2, CV_16SC2);
+	return e;
+}
+
+inline void DeskewCache::set_distortion(const DistortionParameters& params)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_distortion = params;
+	_cached.reset();
+	_last.reset();
+}
+
+inline void DeskewCache::reset()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_cached.reset();
+	_last.reset();
+}
+
+inline uint64_t DeskewCache::hits() const
+{
+	return _hits;
+}
+
+inline uint64_t DeskewCache::misses() const
+{
+	return _misses;
+}
+
+inline double DeskewCache::hit_rate() const
+{
+	uint64_t total = _hits + _misses;
+	return total? (double)_hits / total : 0;
+}
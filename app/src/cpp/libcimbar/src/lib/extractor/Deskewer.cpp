@@ -10,3 +10,84 @@ Deskewer::Deskewer(unsigned padding, cimbar::vec_xy image_size, unsigned anchor_
 	, _padding(padding)
 {
 }
+
+cv::Mat Deskewer::get_transform(const Corners& corners) const
+{
+	return cv::getPerspectiveTransform(corners.all(), output_points());
+}
+
+std::vector<cv::Point2f> Deskewer::output_points() const
+{
+	std::vector<cv::Point2f> outputPoints;
+	outputPoints.push_back(cv::Point2f(_anchorSize+_padding, _anchorSize+_padding));
+	outputPoints.push_back(cv::Point2f(_imageSize.width() - _anchorSize+_padding, _anchorSize+_padding));
+	outputPoints.push_back(cv::Point2f(_anchorSize+_padding, _imageSize.height() - _anchorSize+_padding));
+	outputPoints.push_back(cv::Point2f(_imageSize.width() - _anchorSize+_padding, _imageSize.height() - _anchorSize+_padding));
+	return outputPoints;
+}
+
+cv::Size Deskewer::output_size() const
+{
+	return cv::Size(_imageSize.width() + (_padding*2), _imageSize.height() + (_padding*2));
+}
+
+cv::Mat Deskewer::warp_luma(const cv::Mat& y, const cv::Mat& transform) const
+{
+	// 4:2:0 wants even dimensions. to_rgb() crops back down.
+	cv::Size size = output_size();
+	int width = (size.width + 1) & ~1;
+	int height = (size.height + 1) & ~1;
+
+	cv::Mat yuv(height * 3/2, width, CV_8UC1);
+	cv::Mat luma = yuv.rowRange(0, height);
+	cv::warpPerspective(y, luma, transform, luma.size(), cv::INTER_LINEAR);
+	return yuv;
+}
+
+void Deskewer::warp_chroma(const cv::Mat& chroma, const cv::Mat& transform, cv::Mat& out) const
+{
+	// chroma sample i sits at luma 2i+0.5. So to get from an output chroma sample to an input one:
+	// scale up to luma coordinates, invert the transform, scale back down.
+	cv::Mat half = (cv::Mat_<double>(3, 3) << 0.5, 0, -0.25, 0, 0.5, -0.25, 0, 0, 1);
+	cv::Mat chromaMap = half * transform.inv() * half.inv();
+	// out of bounds is gray, not green
+	cv::warpPerspective(chroma, out, chromaMap, out.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_CONSTANT, cv::Scalar(128, 128));
+}
+
+cv::Mat Deskewer::to_rgb(const cv::Mat& yuv, int code) const
+{
+	cv::Mat rgb;
+	cv::cvtColor(yuv, rgb, code);
+
+	cv::Size size = output_size();
+	if (rgb.cols != size.width or rgb.rows != size.height)
+		rgb = rgb(cv::Rect(0, 0, size.width, size.height)).clone();
+	return rgb;
+}
+
+cv::Mat Deskewer::deskew_nv12(const cv::Mat& y, const cv::Mat& uv, const Corners& corners, bool nv21) const
+{
+	cv::Mat transform = get_transform(corners);
+	cv::Mat yuv = warp_luma(y, transform);
+
+	int height = yuv.rows * 2/3;
+	cv::Mat uvOut(height/2, yuv.cols/2, CV_8UC2, yuv.ptr(height));
+	warp_chroma(uv, transform, uvOut);
+
+	return to_rgb(yuv, nv21? cv::COLOR_YUV2RGB_NV21 : cv::COLOR_YUV2RGB_NV12);
+}
+
+cv::Mat Deskewer::deskew_i420(const cv::Mat& y, const cv::Mat& u, const cv::Mat& v, const Corners& corners) const
+{
+	cv::Mat transform = get_transform(corners);
+	cv::Mat yuv = warp_luma(y, transform);
+
+	int height = yuv.rows * 2/3;
+	int planeSize = (height/2) * (yuv.cols/2);
+	cv::Mat uOut(height/2, yuv.cols/2, CV_8UC1, yuv.ptr(height));
+	cv::Mat vOut(height/2, yuv.cols/2, CV_8UC1, yuv.ptr(height) + planeSize);
+	warp_chroma(u, transform, uOut);
+	warp_chroma(v, transform, vOut);
+
+	return to_rgb(yuv, cv::COLOR_YUV2RGB_I420);
+}
@@ -14,7 +14,27 @@ public:
 	Deskewer(unsigned padding=0, cimbar::vec_xy image_size={}, unsigned anchor_size=0);
 
 	template <typename MAT>
-	MAT deskew(const MAT& img, const Corners& corners);
+	MAT deskew(const MAT& img, const Corners& corners) const;
+
+	// for camera frames still in YUV 4:2:0. The planes are warped separately, and only the output is converted to RGB.
+	// y is the full res luma plane, uv the half res interleaved chroma (U first, unless nv21).
+	cv::Mat deskew_nv12(const cv::Mat& y, const cv::Mat& uv, const Corners& corners, bool nv21=false) const;
+	// same, for planar (I420) chroma
+	cv::Mat deskew_i420(const cv::Mat& y, const cv::Mat& u, const cv::Mat& v, const Corners& corners) const;
+
+	// frame coordinates -> deskewed coordinates. For reading cells straight off the frame, see CimbReader.
+	cv::Mat get_transform(const Corners& corners) const;
+
+	// where the anchor centers end up, and how big the output is
+	std::vector<cv::Point2f> output_points() const;
+	cv::Size output_size() const;
+
+protected:
+
+	// luma into the top of a 4:2:0 buffer. Returns the buffer.
+	cv::Mat warp_luma(const cv::Mat& y, const cv::Mat& transform) const;
+	void warp_chroma(const cv::Mat& chroma, const cv::Mat& transform, cv::Mat& out) const;
+	cv::Mat to_rgb(const cv::Mat& yuv, int code) const;
 
 protected:
 	cimbar::vec_xy _imageSize;
@@ -23,17 +43,11 @@ protected:
 };
 
 template <typename MAT>
-inline MAT Deskewer::deskew(const MAT& img, const Corners& corners)
+inline MAT Deskewer::deskew(const MAT& img, const Corners& corners) const
 {
-	std::vector<cv::Point2f> outputPoints;
-	outputPoints.push_back(cv::Point2f(_anchorSize+_padding, _anchorSize+_padding));
-	outputPoints.push_back(cv::Point2f(_imageSize.width() - _anchorSize+_padding, _anchorSize+_padding));
-	outputPoints.push_back(cv::Point2f(_anchorSize+_padding, _imageSize.height() - _anchorSize+_padding));
-	outputPoints.push_back(cv::Point2f(_imageSize.width() - _anchorSize+_padding, _imageSize.height() - _anchorSize+_padding));
-
 	// + 2*padding ?
 	MAT output(_imageSize.height() + (_padding*2), _imageSize.width() + (_padding*2), img.type());
-	cv::Mat transform = cv::getPerspectiveTransform(corners.all(), outputPoints);
+	cv::Mat transform = get_transform(corners);
 
 	cv::warpPerspective(img, output, transform, output.size(), cv::INTER_LINEAR);
 	return output;
@@ -1,6 +1,7 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "AnchorTracker.h"
 #include "Deskewer.h"
 #include "Scanner.h"
 #include "util/vec_xy.h"
@@ -21,6 +22,25 @@ public:
 	template <typename MAT>
 	int extract(const MAT& img, MAT& out);
 
+	// for a stream of frames: the tracker remembers where the anchors were last time
+	template <typename MAT>
+	int extract(const MAT& img, MAT& out, AnchorTracker& tracker);
+
+	// undistort + deskew in one resample, with anchors from the (distorted) img. UNDISTORT is e.g. Undistort<SimpleCameraCalibration>.
+	// if it can't work out the distortion, this is a plain extract().
+	template <typename MAT, typename UNDISTORT>
+	int extract_undistorted(const MAT& img, MAT& out, UNDISTORT& und);
+
+	// find the anchors, but skip the warp: hand back the deskew transform instead of the deskewed image
+	template <typename MAT>
+	int extract_transform(const MAT& img, cv::Mat& transform);
+
+protected:
+	template <typename MAT>
+	int deskew(const MAT& img, MAT& out, const std::vector<Anchor>& points);
+
+	int get_transform(const std::vector<Anchor>& points, cv::Mat& out);
+
 protected:
 	cimbar::vec_xy _imageSize;
 	unsigned _anchorSize;
@@ -31,7 +51,43 @@ template <typename MAT>
 inline int Extractor::extract(const MAT& img, MAT& out)
 {
 	Scanner scanner(img);
-	std::vector<Anchor> points = scanner.scan();
+	return deskew(img, out, scanner.scan(Scanner::auto_bands(img.cols, img.rows)));
+}
+
+template <typename MAT>
+inline int Extractor::extract(const MAT& img, MAT& out, AnchorTracker& tracker)
+{
+	return deskew(img, out, tracker.scan(img));
+}
+
+template <typename MAT, typename UNDISTORT>
+inline int Extractor::extract_undistorted(const MAT& img, MAT& out, UNDISTORT& und)
+{
+	Scanner scanner(img);
+	std::vector<Anchor> points = scanner.scan(Scanner::auto_bands(img.cols, img.rows));
+	if (points.size() < 4)
+		return FAILURE;
+
+	Corners corners(points);
+	Deskewer de(_padding, _imageSize, _anchorSize);
+	if (!und.undistort_deskew(img, out, corners, de))
+		out = de.deskew(img, corners);
+
+	if ( !corners.is_granular_scale(_imageSize) )
+		return NEEDS_SHARPEN;
+	return SUCCESS;
+}
+
+template <typename MAT>
+inline int Extractor::extract_transform(const MAT& img, cv::Mat& transform)
+{
+	Scanner scanner(img);
+	return get_transform(scanner.scan(Scanner::auto_bands(img.cols, img.rows)), transform);
+}
+
+template <typename MAT>
+inline int Extractor::deskew(const MAT& img, MAT& out, const std::vector<Anchor>& points)
+{
 	if (points.size() < 4)
 		return FAILURE;
 
@@ -43,3 +99,18 @@ inline int Extractor::extract(const MAT& img, MAT& out)
 		return NEEDS_SHARPEN;
 	return SUCCESS;
 }
+
+inline int Extractor::get_transform(const std::vector<Anchor>& points, cv::Mat& out)
+{
+	if (points.size() < 4)
+		return FAILURE;
+
+	// no padding: CimbReader reads the frame as if it were an unpadded grid
+	Corners corners(points);
+	Deskewer de(0, _imageSize, _anchorSize);
+	out = de.get_transform(corners);
+
+	if ( !corners.is_granular_scale(_imageSize) )
+		return NEEDS_SHARPEN;
+	return SUCCESS;
+}
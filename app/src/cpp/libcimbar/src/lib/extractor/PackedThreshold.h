@@ -0,0 +1,266 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "bit_file/bitplane.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// the scanner's preprocess (RGB2GRAY -> GaussianBlur -> Otsu threshold) in one pass over the source image.
+// * the Otsu threshold comes from a histogram of blurred values at a sparse grid of sample points, so we don't need
+//   the whole blurred image before we can start thresholding it.
+// * then we walk down the image once. Each source row is converted to gray when the blur window reaches it,
+//   kept in a ring of `ksize` rows (which stays in cache), and thresholded bits are packed straight into the output.
+// gray conversion and the blur use the same fixed point weights as opencv, so the output matches the 3-pass version
+// (give or take a pixel sitting right on the threshold, when the sampled histogram lands on a different Otsu value).
+class PackedThreshold
+{
+public:
+	static unsigned blur_size(unsigned cols, unsigned rows);
+
+	static void threshold(const cv::Mat& img, bitplane& out);
+	static void threshold(const cv::UMat& img, bitplane& out);
+
+	// for images thresholded some other way (e.g. the adaptive path): nonzero -> 1
+	static void pack(const cv::Mat& binary, bitplane& out);
+
+	// exposed for testing
+	static unsigned otsu(const std::array<unsigned, 256>& hist);
+	static std::vector<unsigned> blur_kernel(unsigned ksize);
+
+protected:
+	static uint8_t gray_pixel(const uchar* p, int channels);
+	static void gray_row(const cv::Mat& img, int y, uint8_t* out);
+	static unsigned sample_threshold(const cv::Mat& img, const std::vector<unsigned>& kernel);
+
+	static int reflect(int i, int len)
+	{
+		// BORDER_REFLECT_101
+		if (len == 1)
+			return 0;
+		while (i < 0 or i >= len)
+			i = (i < 0)? -i : 2*len - 2 - i;
+		return i;
+	}
+};
+
+inline unsigned PackedThreshold::blur_size(unsigned cols, unsigned rows)
+{
+	// get next power of 2 + 1. Min 3.
+	unsigned v = (unsigned)(std::min(cols, rows) * 0.002);
+	v--;
+	v |= v >> 1;
+	v |= v >> 2;
+	v |= v >> 4;
+	v |= v >> 8;
+	v |= v >> 16;
+	return std::max(3U, v + 2);
+}
+
+inline std::vector<unsigned> PackedThreshold::blur_kernel(unsigned ksize)
+{
+	// weights sum to 256. The small kernels are the same tables opencv uses for sigma=0.
+	switch (ksize)
+	{
+		case 3: return {64, 128, 64};
+		case 5: return {16, 64, 96, 64, 16};
+		case 7: return {8, 28, 56, 72, 56, 28, 8};
+		default: break;
+	}
+
+	double sigma = 0.3*((ksize-1)*0.5 - 1) + 0.8;
+	int r = ksize / 2;
+	std::vector<double> weights;
+	double total = 0;
+	for (int i = -r; i <= r; ++i)
+	{
+		weights.push_back(std::exp(-(i*i) / (2*sigma*sigma)));
+		total += weights.back();
+	}
+
+	std::vector<unsigned> kernel;
+	unsigned sum = 0;
+	for (double w : weights)
+	{
+		kernel.push_back(std::lround(w * 256 / total));
+		sum += kernel.back();
+	}
+	// rounding slop goes on the center tap
+	kernel[r] += 256 - sum;
+	return kernel;
+}
+
+inline unsigned PackedThreshold::otsu(const std::array<unsigned, 256>& hist)
+{
+	// same search as opencv's THRESH_OTSU
+	double total = 0;
+	for (unsigned count : hist)
+		total += count;
+	if (total == 0)
+		return 0;
+
+	double scale = 1.0 / total;
+	double mu = 0;
+	for (unsigned i = 0; i < 256; ++i)
+		mu += i * (double)hist[i];
+	mu *= scale;
+
+	double mu1 = 0, q1 = 0;
+	double maxSigma = 0;
+	unsigned maxVal = 0;
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		double p_i = hist[i] * scale;
+		mu1 *= q1;
+		q1 += p_i;
+		double q2 = 1.0 - q1;
+
+		if (std::min(q1, q2) < FLT_EPSILON or std::max(q1, q2) > 1.0 - FLT_EPSILON)
+			continue;
+
+		mu1 = (mu1 + i*p_i) / q1;
+		double mu2 = (mu - q1*mu1) / q2;
+		double sigma = q1*q2*(mu1 - mu2)*(mu1 - mu2);
+		if (sigma > maxSigma)
+		{
+			maxSigma = sigma;
+			maxVal = i;
+		}
+	}
+	return maxVal;
+}
+
+inline uint8_t PackedThreshold::gray_pixel(const uchar* p, int channels)
+{
+	if (channels < 3)
+		return p[0];
+	// opencv's RGB2GRAY: .299, .587, .114 with a 14 bit shift
+	return (p[0]*4899 + p[1]*9617 + p[2]*1868 + (1 << 13)) >> 14;
+}
+
+inline void PackedThreshold::gray_row(const cv::Mat& img, int y, uint8_t* out)
+{
+	const uchar* p = img.ptr<uchar>(y);
+	int channels = img.channels();
+	if (channels < 3)
+	{
+		std::copy(p, p + img.cols, out);
+		return;
+	}
+
+	for (int x = 0; x < img.cols; ++x, p += channels)
+		out[x] = gray_pixel(p, channels);
+}
+
+inline unsigned PackedThreshold::sample_threshold(const cv::Mat& img, const std::vector<unsigned>& kernel)
+{
+	// ~64k samples, regardless of resolution. Small images (like a scan_window) get every pixel.
+	// each sample does its own ksize*ksize blur, straight from the source pixels.
+	int r = kernel.size() / 2;
+	int step = std::max(1, (int)std::sqrt((img.cols * img.rows) / 65536.0));
+	int channels = img.channels();
+
+	std::array<unsigned, 256> hist = {};
+	std::vector<const uchar*> rows(kernel.size());
+	for (int y = step/2; y < img.rows; y += step)
+	{
+		for (unsigned k = 0; k < kernel.size(); ++k)
+			rows[k] = img.ptr<uchar>(reflect(y + (int)k - r, img.rows));
+
+		for (int x = step/2; x < img.cols; x += step)
+		{
+			unsigned sum = 0;
+			for (unsigned j = 0; j < kernel.size(); ++j)
+			{
+				int sx = reflect(x + (int)j - r, img.cols) * channels;
+				unsigned col = 0;
+				for (unsigned k = 0; k < kernel.size(); ++k)
+					col += kernel[k] * gray_pixel(rows[k] + sx, channels);
+				sum += kernel[j] * col;
+			}
+			++hist[(sum + (1 << 15)) >> 16];
+		}
+	}
+	return otsu(hist);
+}
+
+inline void PackedThreshold::threshold(const cv::Mat& img, bitplane& out)
+{
+	out.resize(img.cols, img.rows);
+	if (img.empty())
+		return;
+
+	std::vector<unsigned> kernel = blur_kernel(blur_size(img.cols, img.rows));
+	unsigned ksize = kernel.size();
+	int r = ksize / 2;
+	unsigned thresh = sample_threshold(img, kernel);
+
+	// ring of gray rows. Row y of the image lives in slot y % ksize.
+	std::vector<uint8_t> ring(ksize * img.cols);
+	auto slot = [&] (int y) { return ring.data() + (y % ksize) * img.cols; };
+	int loaded = -1;
+
+	// the vertical pass for one row, padded by r on both sides for the horizontal one
+	std::vector<unsigned> vert(img.cols + 2*r);
+
+	for (int y = 0; y < img.rows; ++y)
+	{
+		int need = std::min(y + r, img.rows - 1);
+		for (; loaded < need; ++loaded)
+			gray_row(img, loaded + 1, slot(loaded + 1));
+
+		for (int x = 0; x < img.cols; ++x)
+			vert[x + r] = 0;
+		for (unsigned k = 0; k < ksize; ++k)
+		{
+			const uint8_t* g = slot(reflect(y + (int)k - r, img.rows));
+			unsigned w = kernel[k];
+			for (int x = 0; x < img.cols; ++x)
+				vert[x + r] += w * g[x];
+		}
+		for (int i = 1; i <= r; ++i)
+		{
+			vert[r - i] = vert[r + reflect(-i, img.cols)];
+			vert[r + img.cols - 1 + i] = vert[r + reflect(img.cols - 1 + i, img.cols)];
+		}
+
+		uint64_t* bits = out.row(y);
+		uint64_t word = 0;
+		for (int x = 0; x < img.cols; ++x)
+		{
+			unsigned sum = 0;
+			for (unsigned j = 0; j < ksize; ++j)
+				sum += kernel[j] * vert[x + j];
+			word = (word << 1) | (((sum + (1 << 15)) >> 16) > thresh);
+			if ((x & 63) == 63)
+			{
+				bits[x >> 6] = word;
+				word = 0;
+			}
+		}
+		if (img.cols & 63)
+			bits[img.cols >> 6] = word << (64 - (img.cols & 63));
+	}
+}
+
+inline void PackedThreshold::threshold(const cv::UMat& img, bitplane& out)
+{
+	threshold(img.getMat(cv::ACCESS_READ), out);
+}
+
+inline void PackedThreshold::pack(const cv::Mat& binary, bitplane& out)
+{
+	out.resize(binary.cols, binary.rows);
+	for (int y = 0; y < binary.rows; ++y)
+	{
+		const uchar* p = binary.ptr<uchar>(y);
+		for (int x = 0; x < binary.cols; ++x)
+			if (p[x])
+				out.set(x, y);
+	}
+}
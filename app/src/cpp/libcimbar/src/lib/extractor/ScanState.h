@@ -47,6 +47,16 @@ public:
 		return NOOP;
 	}
 
+	// the same as `length` calls to process(active).
+	// after the first pixel of a run the state always agrees with it, so that's the only one that can complete a pattern.
+	int process_run(bool active, int length)
+	{
+		int res = process(active);
+		if (length > 1 and ((active and _state % 2 == 1) or (!active and (_state == 2 or _state == 4))))
+			_tally.back() += length - 1;
+		return res;
+	}
+
 protected:
 	void pop_state()
 	{
@@ -6,6 +6,8 @@
 #include "Geometry.h"
 #include "ScanState.h"
 #include <algorithm>
+#include <future>
+#include <thread>
 
 namespace {
 	struct size_sort
@@ -50,11 +52,8 @@ int Scanner::anchor_size() const
 
 bool Scanner::test_pixel(int x, int y) const
 {
-	uchar pixel = _img.at<uchar>(y, x);
-	if (_dark)
-		return pixel > 127;
-	else
-		return pixel < 127;
+	bool bit = _img.get(x, y);
+	return _dark? bit : !bit;
 }
 
 std::vector<Anchor> Scanner::deduplicate_candidates(const std::vector<Anchor>& candidates) const
@@ -180,21 +179,64 @@ bool Scanner::add_bottom_right_corner(std::vector<Anchor>& anchors, unsigned cut
 	return false;
 }
 
-unsigned Scanner::scan_primary(std::vector<Anchor>& candidates)
+unsigned Scanner::auto_bands(int cols, int rows)
 {
-	t1_scan_rows<ScanState_114>([&] (const Anchor& p) {
-		on_t1_scan<ScanState_114>(p, candidates, true);
-	});
+	// below ~8MP, the scan is quick enough that threads would just be overhead
+	if ((long)cols * rows < 8000000)
+		return 1;
+	return std::clamp<unsigned>(std::thread::hardware_concurrency(), 1, 8);
+}
+
+void Scanner::scan_bands(std::vector<Anchor>& candidates, unsigned bands) const
+{
+	// bands start on a multiple of _skip, so we scan the same rows as a single pass would.
+	// only the t1 row scan is split. The t2-t4 confirms look at the whole image, so an anchor crossing a band
+	// boundary is found whole -- possibly by both bands.
+	int numRows = (_img.height() - 1) / _skip;
+	int rowsPerBand = (numRows + bands - 1) / bands;
+
+	std::vector<std::vector<Anchor>> found(bands);
+	std::vector<std::future<void>> jobs;
+	for (unsigned b = 0; b < bands; ++b)
+	{
+		int ystart = _skip * (1 + b * rowsPerBand);
+		int yend = std::min(ystart + _skip * rowsPerBand, _img.height());
+		if (ystart >= yend)
+			break;
+
+		jobs.push_back(std::async(std::launch::async, [this, &found, b, ystart, yend] () {
+			t1_scan_rows<ScanState_114>([&] (const Anchor& p) {
+				on_t1_scan<ScanState_114>(p, found[b], true);
+			}, _skip, ystart, yend);
+		}));
+	}
+	for (std::future<void>& job : jobs)
+		job.get();
+
+	// merge in band order, so the result doesn't depend on which thread finished first
+	for (const std::vector<Anchor>& band : found)
+		candidates.insert(candidates.end(), band.begin(), band.end());
+	candidates = deduplicate_candidates(candidates);
+}
+
+unsigned Scanner::scan_primary(std::vector<Anchor>& candidates, unsigned bands)
+{
+	if (bands > 1 and _skip > 0)
+		scan_bands(candidates, bands);
+	else
+		t1_scan_rows<ScanState_114>([&] (const Anchor& p) {
+			on_t1_scan<ScanState_114>(p, candidates, true);
+		});
 
 	unsigned cutoff = filter_candidates(candidates);
 	sort_top_to_bottom(candidates);
 	return cutoff;
 }
 
-std::vector<Anchor> Scanner::scan()
+std::vector<Anchor> Scanner::scan(unsigned bands)
 {
 	std::vector<Anchor> candidates;
-	unsigned cutoff = scan_primary(candidates);
+	unsigned cutoff = scan_primary(candidates, bands);
 
 	if (candidates.size() == 3 and cutoff != 0)
 		add_bottom_right_corner(candidates, cutoff);
@@ -239,7 +281,7 @@ point<int> Scanner::find_edge(const point<int>& u, const point<int>& v, point<do
 		{
 			double x = mid.x() + i;
 			double y = mid.y() + j;
-			if (x < 0 or x >= _img.cols or y < 0 or y >= _img.rows)
+			if (x < 0 or x >= _img.width() or y < 0 or y >= _img.height())
 			{
 				i += unit.x();
 				j += unit.y();
@@ -3,10 +3,13 @@
 
 #include "Anchor.h"
 #include "Corners.h"
+#include "PackedThreshold.h"
 #include "Point.h"
 #include "ScanState.h"
+#include "bit_file/bitplane.h"
 
 #include <opencv2/opencv.hpp>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <vector>
@@ -37,8 +40,21 @@ public: // public inline methods
 	template <typename MAT>
 	static bool will_it_scan(const MAT& img);
 
+	// coarse-to-fine: find the anchors on a copy downscaled (by a power of 2) to ~target_dim on its short side,
+	// then refine each one in a small full resolution window. Images that are already small get a normal scan().
+	template <typename MAT>
+	static std::vector<Anchor> scan_pyramid(const MAT& img, unsigned target_dim=480, bool fast=true, bool dark=true);
+
+	// look for a single anchor within `margin` pixels of where we think it is. If we find it, `anchor` is updated.
+	template <typename MAT>
+	static bool scan_window(const MAT& img, Anchor& anchor, bool primary, int margin, bool fast=true, bool dark=true);
+
+	// how many bands scan() should split an image this size into. 1 (no threads) unless it's a big photo.
+	static unsigned auto_bands(int cols, int rows);
+
 	// rest of public interface
-	std::vector<Anchor> scan();
+	// with bands > 1, the t1 row scan is split into horizontal bands that run in parallel.
+	std::vector<Anchor> scan(unsigned bands=1);
 	std::vector<point<int>> scan_edges(const Corners& corners, Midpoints& mps) const;
 	int anchor_size() const;
 
@@ -59,7 +75,8 @@ public: // other interesting methods
 	template <typename SCANTYPE>
 	void t4_confirm_scan(Anchor hint, bool merge_confirms, std::function<void(const Anchor&)> fun) const;
 
-	unsigned scan_primary(std::vector<Anchor>& candidates);
+	unsigned scan_primary(std::vector<Anchor>& candidates, unsigned bands=1);
+	void scan_bands(std::vector<Anchor>& candidates, unsigned bands) const;
 	bool add_bottom_right_corner(std::vector<Anchor>& anchors, unsigned cutoff);
 
 protected: // internal member functions
@@ -77,12 +94,15 @@ protected: // internal member functions
 	template <typename SCANTYPE>
 	void on_t1_scan(const Anchor& found, std::vector<Anchor>& candidates, bool merge_confirms) const;
 
+	template <typename SCANTYPE>
+	bool refine_anchor(Anchor& anchor, bool merge_confirms) const;
+
 	// edge detection
 	bool chase_edge(const point<double>& start, const point<double>& unit) const;
 	point<int> find_edge(const point<int>& u, const point<int>& v, point<double> mid) const;
 
 protected:
-	cv::Mat _img;
+	bitplane _img;
 	bool _dark;
 	int _skip;
 	int _mergeCutoff;
@@ -123,6 +143,55 @@ inline bool Scanner::will_it_scan(const MAT& unpadded_img)
 	return true;
 }
 
+template <typename MAT>
+inline std::vector<Anchor> Scanner::scan_pyramid(const MAT& img, unsigned target_dim, bool fast, bool dark)
+{
+	unsigned factor = 1;
+	unsigned minDim = std::min(img.cols, img.rows);
+	while (minDim / (factor * 2) >= target_dim)
+		factor *= 2;
+	if (factor == 1)
+		return Scanner(img, fast, dark).scan();
+
+	MAT small;
+	cv::resize(img, small, cv::Size(img.cols / factor, img.rows / factor), 0, 0, cv::INTER_AREA);
+	std::vector<Anchor> anchors = Scanner(small, fast, dark).scan();
+
+	int f = factor;
+	for (unsigned i = 0; i < anchors.size(); ++i)
+	{
+		const Anchor& coarse = anchors[i];
+		Anchor scaled(coarse.x() * f, coarse.xmax() * f + f - 1, coarse.y() * f, coarse.ymax() * f + f - 1);
+
+		// an anchor's width of slack on every side. The first 3 are primary anchors, the 4th (if we found it) is the bottom right one.
+		// if the refinement misses, we keep the scaled up coarse anchor.
+		scan_window(img, scaled, i < 3, scaled.max_range() + f, fast, dark);
+		anchors[i] = scaled;
+	}
+	return anchors;
+}
+
+template <typename MAT>
+inline bool Scanner::scan_window(const MAT& img, Anchor& anchor, bool primary, int margin, bool fast, bool dark)
+{
+	int xstart = std::max(0, anchor.x() - margin);
+	int ystart = std::max(0, anchor.y() - margin);
+	int xend = std::min(img.cols, anchor.xmax() + margin);
+	int yend = std::min(img.rows, anchor.ymax() + margin);
+	if (xend <= xstart or yend <= ystart)
+		return false;
+	cv::Rect roi(xstart, ystart, xend - xstart, yend - ystart);
+
+	int skip = std::max(1, std::min(roi.width, roi.height) / (primary? 24 : 48));
+	Scanner fine(img(roi), fast, dark, skip);
+
+	Anchor found;
+	bool res = primary? fine.refine_anchor<ScanState_114>(found, true) : fine.refine_anchor<ScanState_122>(found, false);
+	if (res)
+		anchor = Anchor(found.x() + xstart, found.xmax() + xstart, found.y() + ystart, found.ymax() + ystart);
+	return res;
+}
+
 template <typename MAT, typename MAT2>
 inline void Scanner::threshold_fast(const MAT& img, MAT2& out)
 {
@@ -154,8 +223,7 @@ inline void Scanner::preprocess_image(const MAT& img, MAT2& out, bool fast)
 	else
 		temp = img.clone();
 
-	unsigned unit = std::min(img.cols, img.rows);
-	unit = std::max(nextPowerOfTwoPlusOne((unsigned)(unit * 0.002)), 3U);
+	unsigned unit = PackedThreshold::blur_size(img.cols, img.rows);
 	cv::GaussianBlur(temp, temp, cv::Size(unit, unit), 0);
 
 	if (fast)
@@ -171,7 +239,11 @@ inline Scanner::Scanner(const MAT& img, bool fast, bool dark, int skip)
 	, _mergeCutoff(img.cols / 30)
 	, _anchorSize(30)
 {
-	_img = preprocess_image(img, fast);
+	// the fast path is fused into a single pass. Adaptive thresholding still goes through opencv.
+	if (fast)
+		PackedThreshold::threshold(img, _img);
+	else
+		PackedThreshold::pack(preprocess_image(img, fast), _img);
 }
 
 template <typename SCANTYPE>
@@ -179,17 +251,20 @@ inline bool Scanner::scan_horizontal(std::vector<Anchor>& points, int y, int xst
 {
 	if (xstart < 0)
 		xstart = 0;
-	if (xend < 0 or xend > _img.cols)
-		xend = _img.cols;
+	if (xend < 0 or xend > _img.width())
+		xend = _img.width();
 
+	// feed the state whole runs of pixels. A run ends at the next set (or unset) bit, so we can skip to it with clz.
 	unsigned initCount = points.size();
 	SCANTYPE state;
-	for (int x = xstart; x < xend; ++x)
+	for (int x = xstart; x < xend;)
 	{
 		bool active = test_pixel(x, y);
-		int res = state.process(active);
+		int len = _img.run_length(x, y, xend);
+		int res = state.process_run(active, len);
 		if (res > 0)
 			points.push_back(Anchor(x-res, x-1, y, y));
+		x += len;
 	}
 
 	// if the pattern is at the edge of the range
@@ -211,8 +286,8 @@ inline bool Scanner::scan_vertical(std::vector<Anchor>& points, int x, int xmax,
 
 	if (ystart < 0)
 		ystart = 0;
-	if (yend < 0 or yend > _img.rows)
-		yend = _img.rows;
+	if (yend < 0 or yend > _img.height())
+		yend = _img.height();
 
 	unsigned initCount = points.size();
 	SCANTYPE state;
@@ -237,8 +312,8 @@ inline bool Scanner::scan_vertical(std::vector<Anchor>& points, int x, int xmax,
 template <typename SCANTYPE>
 inline bool Scanner::scan_diagonal(std::vector<Anchor>& points, int xstart, int xend, int ystart, int yend) const
 {
-	xend = std::min(xend, _img.cols);
-	yend = std::min(yend, _img.rows);
+	xend = std::min(xend, _img.width());
+	yend = std::min(yend, _img.height());
 
 	// if we're up against the top/left bounds, roll the scan forward until we're inside the bounds
 	if (xstart < 0)
@@ -281,8 +356,8 @@ inline void Scanner::t1_scan_rows(std::function<void(const Anchor&)> fun, int sk
 		skip = _skip;
 	if (y < 0)
 		y = skip;
-	if (yend < 0 or yend > _img.rows)
-		yend = _img.rows;
+	if (yend < 0 or yend > _img.height())
+		yend = _img.height();
 
 	std::vector<Anchor> points;
 	for (; y < yend; y += skip)
@@ -389,6 +464,21 @@ inline void Scanner::t4_confirm_scan(Anchor hint, bool merge_confirms, std::func
 	fun(hint);
 }
 
+// for a scanner over a window that should hold exactly one anchor
+template <typename SCANTYPE>
+inline bool Scanner::refine_anchor(Anchor& anchor, bool merge_confirms) const
+{
+	std::vector<Anchor> candidates;
+	t1_scan_rows<SCANTYPE>([&] (const Anchor& p) {
+		on_t1_scan<SCANTYPE>(p, candidates, merge_confirms);
+	});
+	if (candidates.empty())
+		return false;
+
+	anchor = *std::max_element(candidates.begin(), candidates.end(), [] (const Anchor& a, const Anchor& b) { return a.size() < b.size(); });
+	return true;
+}
+
 template <typename SCANTYPE>
 inline void Scanner::on_t1_scan(const Anchor& found, std::vector<Anchor>& candidates, bool merge_confirms) const
 {
@@ -1,8 +1,13 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "Corners.h"
+#include "DeskewCache.h"
+#include "Deskewer.h"
 #include "DistortionParameters.h"
 #include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
 
 template <typename CAMERA_CALIBRATOR>
 class Undistort
@@ -30,17 +35,46 @@ public:
 				return false;
 		}
 
+		if (_map1.empty())
+			cv::initUndistortRectifyMap(_params.camera, _params.distortion, cv::Mat(), _params.camera, _size, CV_32FC1, _map1, _map2);
 		cv::remap(img, out, _map1, _map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
 		return true;
 	}
 
+	// undistort() + deskew, as one remap over just the output grid. Corners are from the (distorted) img.
+	// the composed map is kept for as long as the corners hold still.
+	template <typename MAT>
+	bool undistort_deskew(const MAT& img, MAT& out, const Corners& corners, const Deskewer& de=Deskewer())
+	{
+		if (!_params)
+		{
+			if ( !set_distortion_params(img.cols, img.rows, get_distortion_parameters(img)) )
+				return false;
+		}
+
+		out = _deskew.deskew(img, undistort_corners(corners), de);
+		return true;
+	}
+
+	Corners undistort_corners(const Corners& corners) const
+	{
+		std::vector<cv::Point2f> points;
+		cv::undistortPoints(corners.all(), points, _params.camera, _params.distortion, cv::noArray(), _params.camera);
+		auto pt = [&points] (unsigned i) { return point<int>(std::lround(points[i].x), std::lround(points[i].y)); };
+		return Corners(pt(0), pt(1), pt(2), pt(3));
+	}
+
 	bool set_distortion_params(int width, int height, const DistortionParameters& params)
 	{
 		if (!params)
 			return false;
 
+		// the full frame maps are only built if undistort() needs them
 		_params = params;
-		cv::initUndistortRectifyMap(_params.camera, _params.distortion, cv::Mat(), _params.camera, cv::Size(width, height), CV_32FC1, _map1, _map2);
+		_size = cv::Size(width, height);
+		_map1.release();
+		_map2.release();
+		_deskew.set_distortion(params);
 		return true;
 	}
 
@@ -49,10 +83,18 @@ public:
 		_params = {};
 		_map1.release();
 		_map2.release();
+		_deskew.set_distortion({});
+	}
+
+	operator bool() const
+	{
+		return (bool)_params;
 	}
 
 protected:
 	DistortionParameters _params;
+	cv::Size _size;
 	cv::Mat _map1;
 	cv::Mat _map2;
+	DeskewCache _deskew;
 };
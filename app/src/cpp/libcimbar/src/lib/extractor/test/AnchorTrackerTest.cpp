@@ -0,0 +1,85 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+#include "TestHelpers.h"
+
+#include "AnchorTracker.h"
+
+#include "Point.h"
+#include "serialize/format.h"
+#include "serialize/str_join.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	void assertClose(const std::vector<Anchor>& expected, const std::vector<Anchor>& actual, point<int> offset={0, 0})
+	{
+		assertEquals( expected.size(), actual.size() );
+		for (unsigned i = 0; i < expected.size(); ++i)
+		{
+			point<int> want = expected[i].center() + offset;
+			point<int> got = actual[i].center();
+			assertMsg( abs(got.x() - want.x()) <= 4 and abs(got.y() - want.y()) <= 4,
+					   fmt::format("{}: {},{} vs {},{}", i, got.x(), got.y(), want.x(), want.y()) );
+		}
+	}
+}
+
+TEST_CASE( "AnchorTrackerTest/testTrack", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	std::vector<Anchor> expected = Scanner(img).scan();
+
+	AnchorTracker tracker;
+	assertFalse( tracker.tracking() );
+
+	// first frame is a full scan
+	assertEquals( turbo::str::join(expected), turbo::str::join(tracker.scan(img)) );
+	assertTrue( tracker.tracking() );
+	assertEquals( 0, tracker.tracked() );
+	assertEquals( 1, tracker.full_scans() );
+
+	// same frame again
+	assertClose( expected, tracker.scan(img) );
+	assertEquals( 1, tracker.tracked() );
+	assertEquals( 1, tracker.full_scans() );
+
+	// the barcode moved a little
+	cv::Mat shifted;
+	cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0, 12, 0, 1, -9);
+	cv::warpAffine(img, shifted, shift, img.size(), cv::INTER_NEAREST, cv::BORDER_REPLICATE);
+	assertClose( expected, tracker.scan(shifted), {12, -9} );
+	assertEquals( 2, tracker.tracked() );
+	assertEquals( 1, tracker.full_scans() );
+}
+
+TEST_CASE( "AnchorTrackerTest/testLostTrack", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	std::vector<Anchor> expected = Scanner(img).scan();
+
+	AnchorTracker tracker;
+	tracker.scan(img);
+	assertTrue( tracker.tracking() );
+
+	// nothing to see -> fall back to a full scan, which also comes up empty
+	cv::Mat blank(img.size(), img.type(), cv::Scalar(255, 255, 255));
+	assertEquals( 0, tracker.scan(blank).size() );
+	assertEquals( 0, tracker.tracked() );
+	assertEquals( 2, tracker.full_scans() );
+	assertFalse( tracker.tracking() );
+
+	// and we pick it back up
+	assertEquals( turbo::str::join(expected), turbo::str::join(tracker.scan(img)) );
+	assertEquals( 3, tracker.full_scans() );
+
+	// a different frame size means the old positions don't apply
+	cv::Mat bigger;
+	cv::copyMakeBorder(img, bigger, 0, 20, 0, 20, cv::BORDER_REPLICATE);
+	tracker.scan(bigger);
+	assertEquals( 0, tracker.tracked() );
+	assertEquals( 4, tracker.full_scans() );
+
+	tracker.reset();
+	assertFalse( tracker.tracking() );
+}
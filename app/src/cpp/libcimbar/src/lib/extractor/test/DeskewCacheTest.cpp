@@ -0,0 +1,50 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+#include "TestHelpers.h"
+
+#include "DeskewCache.h"
+#include "image_hash/average_hash.h"
+#include <string>
+
+TEST_CASE( "DeskewCacheTest/testSimple", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_big.jpg");
+	Corners corners({312, 519}, {323, 2586}, {2405, 461}, {2425, 2594});
+	Deskewer de(0, {1024, 1024}, 30);
+	DeskewCache cache;
+
+	// first sighting: a plain warp
+	cv::Mat warped = cache.deskew(img, corners, de);
+	assertEquals( 0, cache.hits() );
+	assertEquals( 1, cache.misses() );
+
+	// corners held still, so now we build the maps. Same picture, give or take rounding.
+	cv::Mat remapped = cache.deskew(img, corners, de);
+	assertEquals( 0, cache.hits() );
+	assertEquals( 2, cache.misses() );
+	assertEquals( cv::Size(1024, 1024), remapped.size() );
+	assertEquals( image_hash::average_hash(warped), image_hash::average_hash(remapped) );
+
+	cv::Mat diff;
+	cv::absdiff(warped, remapped, diff);
+	cv::Scalar avgDiff = cv::mean(diff);
+	assertTrue( (avgDiff[0] < 0.1 and avgDiff[1] < 0.1 and avgDiff[2] < 0.1) );
+
+	// a pixel of jitter reuses them
+	Corners jitter({313, 519}, {323, 2585}, {2405, 461}, {2424, 2595});
+	cv::Mat hit = cache.deskew(img, jitter, de);
+	assertEquals( 1, cache.hits() );
+	assertEquals( 0, cv::norm(remapped, hit, cv::NORM_INF) );
+
+	// ... but a real move doesn't
+	Corners moved({320, 519}, {323, 2586}, {2405, 461}, {2425, 2594});
+	cache.deskew(img, moved, de);
+	assertEquals( 1, cache.hits() );
+	assertEquals( 3, cache.misses() );
+
+	// and neither does a different output geometry
+	cache.deskew(img, corners, Deskewer(8, {1024, 1024}, 30));
+	assertEquals( 1, cache.hits() );
+	assertEquals( 4, cache.misses() );
+	assertEquals( 0.2, cache.hit_rate() );
+}
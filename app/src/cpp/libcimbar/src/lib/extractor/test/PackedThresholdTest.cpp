@@ -0,0 +1,82 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+#include "TestHelpers.h"
+
+#include "PackedThreshold.h"
+#include "Scanner.h"
+
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	unsigned count_mismatches(const bitplane& bits, const cv::Mat& expected)
+	{
+		unsigned mismatches = 0;
+		for (int y = 0; y < expected.rows; ++y)
+			for (int x = 0; x < expected.cols; ++x)
+				mismatches += bits.get(x, y) != (expected.at<uchar>(y, x) > 0);
+		return mismatches;
+	}
+}
+
+TEST_CASE( "PackedThresholdTest/testKernel", "[unit]" )
+{
+	for (unsigned ksize : {3, 5, 7, 9, 17})
+	{
+		std::vector<unsigned> kernel = PackedThreshold::blur_kernel(ksize);
+		assertEquals( ksize, kernel.size() );
+
+		unsigned total = 0;
+		for (unsigned w : kernel)
+			total += w;
+		assertEquals( 256, total );
+	}
+
+	assertEquals( 3, PackedThreshold::blur_size(1080, 1920) );
+	assertEquals( 5, PackedThreshold::blur_size(2160, 3840) );
+}
+
+TEST_CASE( "PackedThresholdTest/testOtsu", "[unit]" )
+{
+	std::array<unsigned, 256> hist = {};
+	hist[40] = 500;
+	hist[41] = 500;
+	hist[200] = 300;
+	hist[210] = 300;
+
+	unsigned thresh = PackedThreshold::otsu(hist);
+	assertTrue( thresh >= 41 );
+	assertTrue( thresh < 200 );
+}
+
+TEST_CASE( "PackedThresholdTest/testMatchesOpencv", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+
+	bitplane bits;
+	PackedThreshold::threshold(img, bits);
+	assertEquals( img.cols, bits.width() );
+	assertEquals( img.rows, bits.height() );
+
+	// the sampled histogram can pick a slightly different threshold, so allow a sliver of disagreement
+	cv::Mat expected = Scanner::preprocess_image(img, true);
+	unsigned mismatches = count_mismatches(bits, expected);
+	assertTrue( mismatches * 1000 < (unsigned)(img.cols * img.rows) );
+}
+
+TEST_CASE( "PackedThresholdTest/testGrayscaleRoi", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	cv::Mat gray;
+	cv::cvtColor(img, gray, cv::COLOR_RGB2GRAY);
+	cv::Mat roi = gray(cv::Rect(150, 10, 130, 110));
+
+	// small enough that every pixel is sampled, so Otsu comes out the same.
+	// (a pixel landing exactly on the threshold could still round the other way)
+	bitplane bits;
+	PackedThreshold::threshold(roi, bits);
+	cv::Mat expected = Scanner::preprocess_image(roi, true);
+	assertTrue( count_mismatches(bits, expected) <= 4 );
+}
@@ -41,3 +41,23 @@ TEST_CASE( "ScanStateTest/testScan", "[unit]" )
 	assertEquals(ScanState::NOOP, state.process(false));
 	assertEquals(ScanState::NOOP, state.process(false));
 }
+
+TEST_CASE( "ScanStateTest/testProcessRun", "[unit]" )
+{
+	// same pattern as testScan, a run at a time
+	ScanState_114 state;
+	assertEquals(ScanState::NOOP, state.process_run(false, 6));
+	assertEquals(ScanState::NOOP, state.process_run(true, 1));
+	assertEquals(ScanState::NOOP, state.process_run(false, 1));
+	assertEquals(ScanState::NOOP, state.process_run(true, 1));
+	assertEquals(ScanState::NOOP, state.process_run(false, 2));
+	assertEquals(ScanState::NOOP, state.process_run(true, 3));
+	assertEquals(ScanState::NOOP, state.process_run(false, 3));
+	assertEquals(ScanState::NOOP, state.process_run(true, 12));
+	assertEquals(ScanState::NOOP, state.process_run(false, 3));
+	assertEquals(ScanState::NOOP, state.process_run(true, 3));
+
+	// found one!
+	assertEquals( 24, state.process_run(false, 5) );
+	assertEquals(ScanState::NOOP, state.process_run(true, 1));
+}
@@ -7,6 +7,7 @@
 #include "Corners.h"
 #include "Midpoints.h"
 #include "Point.h"
+#include "serialize/format.h"
 #include "serialize/str_join.h"
 #include <iostream>
 #include <string>
@@ -146,6 +147,54 @@ TEST_CASE( "ScannerTest/testExampleScan", "[unit]" )
 	);
 }
 
+TEST_CASE( "ScannerTest/testPyramidScan", "[unit]" )
+{
+	cv::Mat sample = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	cv::Mat img;
+	cv::resize(sample, img, cv::Size(sample.cols * 4, sample.rows * 4), 0, 0, cv::INTER_LINEAR);
+
+	std::vector<Anchor> expected = Scanner(img).scan();
+	assertEquals( 4, expected.size() );
+
+	std::vector<Anchor> candidates = Scanner::scan_pyramid(img);
+	assertEquals( 4, candidates.size() );
+	for (unsigned i = 0; i < 4; ++i)
+	{
+		point<int> actual = candidates[i].center();
+		point<int> want = expected[i].center();
+		assertMsg( abs(actual.x() - want.x()) <= 8 and abs(actual.y() - want.y()) <= 8,
+				   fmt::format("{}: {},{} vs {},{}", i, actual.x(), actual.y(), want.x(), want.y()) );
+	}
+
+	// small images scan normally
+	assertEquals( turbo::str::join(Scanner(sample).scan()), turbo::str::join(Scanner::scan_pyramid(sample)) );
+}
+
+TEST_CASE( "ScannerTest/testBandScan", "[unit]" )
+{
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	Scanner sc(img);
+
+	std::vector<Anchor> expected = sc.scan();
+	assertEquals( 4, expected.size() );
+
+	for (unsigned bands : {2, 3, 7})
+	{
+		std::vector<Anchor> candidates = sc.scan(bands);
+		assertEquals( 4, candidates.size() );
+		for (unsigned i = 0; i < 4; ++i)
+		{
+			point<int> actual = candidates[i].center();
+			point<int> want = expected[i].center();
+			assertMsg( abs(actual.x() - want.x()) <= 4 and abs(actual.y() - want.y()) <= 4,
+					   fmt::format("{} bands, {}: {},{} vs {},{}", bands, i, actual.x(), actual.y(), want.x(), want.y()) );
+		}
+	}
+
+	assertEquals( 1, Scanner::auto_bands(1920, 1080) );
+	assertTrue( Scanner::auto_bands(6000, 4000) >= 1 );
+}
+
 TEST_CASE( "ScannerTest/testExampleScan.2", "[unit]" )
 {
 	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f1_360.jpg");
@@ -6,11 +6,40 @@
 
 #include "Extractor.h"
 #include "SimpleCameraCalibration.h"
+#include "cimb_translator/CimbDecoder.h"
+#include "cimb_translator/CimbReader.h"
 #include "image_hash/average_hash.h"
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
+namespace {
+	std::map<unsigned, unsigned> read_symbols(const cv::Mat& img, CimbDecoder& decoder)
+	{
+		std::map<unsigned, unsigned> res;
+		CimbReader cr(img, decoder, 1);
+		while (!cr.done())
+		{
+			PositionData pos;
+			unsigned bits = cr.read(pos);
+			res[pos.i] = bits;
+		}
+		return res;
+	}
+
+	unsigned count_errors(const std::map<unsigned, unsigned>& actual, const std::map<unsigned, unsigned>& expected)
+	{
+		unsigned errors = 0;
+		for (auto [i, bits] : expected)
+		{
+			auto it = actual.find(i);
+			errors += it == actual.end() or it->second != bits;
+		}
+		return errors;
+	}
+}
+
 TEST_CASE( "UndistortTest/testUndistort", "[unit]" )
 {
 	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
@@ -35,3 +64,38 @@ TEST_CASE( "UndistortTest/testUndistortAndExtract", "[unit]" )
 
 	assertEquals( 0x18f26faca7766794, image_hash::average_hash(out) );
 }
+
+TEST_CASE( "UndistortTest/testUndistortDeskew", "[unit]" )
+{
+	// one resample instead of two. The anchors are found on the distorted frame, so it's close to -- not exactly -- the two step version
+	cv::Mat img = TestCimbar::loadSample("6bit/4_30_f0_627.jpg");
+	cv::Mat out;
+
+	Undistort<SimpleCameraCalibration> und;
+	Extractor ex(0, {1024, 1024}, 30);
+	assertTrue( ex.extract_undistorted(img, out, und) );
+	assertTrue( und );
+	assertEquals( cv::Size(1024, 1024), out.size() );
+
+	// the composed map is cached: a second frame with the same corners is a cache hit, and has to come out the same
+	cv::Mat again;
+	assertTrue( ex.extract_undistorted(img, again, und) );
+	assertEquals( 0, cv::norm(out, again, cv::NORM_INF) );
+
+	// the two step version, for comparison
+	cv::Mat twoStep;
+	{
+		Undistort<SimpleCameraCalibration> und2;
+		assertTrue( und2.undistort(img, twoStep) );
+		assertTrue( ex.extract(twoStep, twoStep) );
+	}
+
+	// the symbols decode as well as they do after two resamples. The clean frame gives us the right answers
+	CimbDecoder decoder(4, 2);
+	std::map<unsigned, unsigned> expected = read_symbols(TestCimbar::loadSample("6bit/4color_ecc30_fountain_0.png"), decoder);
+	assertEquals( 12400, expected.size() );
+
+	unsigned twoStepErrors = count_errors(read_symbols(twoStep, decoder), expected);
+	unsigned errors = count_errors(read_symbols(out, decoder), expected);
+	assertTrue( (errors <= twoStepErrors + 12) );
+}
@@ -4,14 +4,29 @@
 #include "fountain_decoder_sink.h"
 
 #include "concurrentqueue/concurrentqueue.h"
+#include <array>
+#include <memory>
 #include <mutex>
 
+// fountain_decoder_sink, sharded by stream slot (the low bits of the encode_id) so different files decode in parallel.
+// each shard has its own backlog, drained by whichever writer wins its try_lock.
+// chunks are staged in a fixed arena. If the arena is exhausted, the writer blocks on the shard and decodes directly,
+// then drains whatever was staged on the shard meanwhile.
 class concurrent_fountain_decoder_sink
 {
 public:
-	concurrent_fountain_decoder_sink(unsigned chunk_size, const std::function<std::string(const std::string&, const std::vector<uint8_t>&)>& on_store=nullptr)
-		: _decoder(chunk_size, on_store)
+	static const unsigned NUM_SHARDS = 8;
+
+public:
+	concurrent_fountain_decoder_sink(unsigned chunk_size, const std::function<std::string(const std::string&, const std::vector<uint8_t>&)>& on_store=nullptr, unsigned arena_chunks=64)
+		: _chunkSize(chunk_size)
+		, _arena(arena_chunks * chunk_size)
+		, _arenaLengths(arena_chunks, 0)
 	{
+		for (unsigned i = 0; i < NUM_SHARDS; ++i)
+			_shards[i] = std::make_unique<shard>(chunk_size, on_store);
+		for (unsigned i = 0; i < arena_chunks; ++i)
+			_free.enqueue(i);
 	}
 
 	bool good() const
@@ -21,74 +36,142 @@ public:
 
 	unsigned chunk_size() const
 	{
-		return _decoder.chunk_size();
+		return _chunkSize;
 	}
 
 	unsigned num_streams() const
 	{
-		return _decoder.num_streams();
+		std::lock_guard<std::mutex> lock(_readMutex);
+		unsigned total = 0;
+		for (const auto& sh : _shards)
+			total += sh->numStreams;
+		return total;
 	}
 
 	unsigned num_done() const
 	{
-		return _decoder.num_done();
+		std::lock_guard<std::mutex> lock(_readMutex);
+		unsigned total = 0;
+		for (const auto& sh : _shards)
+			total += sh->done.size();
+		return total;
 	}
 
 	std::vector<std::string> get_done() const
 	{
 		std::lock_guard<std::mutex> lock(_readMutex);
-		return _done;
+		std::vector<std::string> done;
+		for (const auto& sh : _shards)
+			done.insert(done.end(), sh->done.begin(), sh->done.end());
+		return done;
 	}
 
 	std::vector<double> get_progress() const
 	{
 		std::lock_guard<std::mutex> lock(_readMutex);
-		return _progress;
-	}
-
-	void update_status()
-	{
-		// we call this under the writeMutex+readMutex. The `const`s are only under readMutex.
-		// just thought you ought to know
-		std::lock_guard<std::mutex> lock(_readMutex);
-		_done = _decoder.get_done();
-		_progress = _decoder.get_progress();
+		std::vector<double> progress;
+		for (const auto& sh : _shards)
+			progress.insert(progress.end(), sh->progress.begin(), sh->progress.end());
+		return progress;
 	}
 
-	void process()
+	void process(unsigned s)
 	{
-		if (_writeMutex.try_lock())
+		shard& sh = *_shards[s];
+		// a chunk can land in the backlog just after we stop draining it, so look again once we've let go.
+		while (sh.backlog.size_approx() > 0 and sh.writeMutex.try_lock())
 		{
-			// maybe a 2nd mutex for retrieving _decoder.has_file()??
-			std::string buff;
-			while (_backlog.try_dequeue(buff))
-				_decoder << buff;
-
-			update_status();
-			_writeMutex.unlock();
+			unsigned idx;
+			while (sh.backlog.try_dequeue(idx))
+			{
+				sh.decoder.write(arena_chunk(idx), _arenaLengths[idx]);
+				_free.enqueue(idx);
+			}
+
+			update_status(sh);
+			sh.writeMutex.unlock();
 		}
 	}
 
 	bool write(const char* data, unsigned length)
 	{
-		std::string buffer(data, length);
-		operator<<(buffer);
+		unsigned s = shard_for(data, length);
+		shard& sh = *_shards[s];
+
+		unsigned idx;
+		if (length > _chunkSize or !_free.try_dequeue(idx))
+		{
+			// no room to stage it. Wait our turn.
+			{
+				std::lock_guard<std::mutex> lock(sh.writeMutex);
+				sh.decoder.write(data, length);
+				update_status(sh);
+			}
+			// anyone who staged a chunk while we held the lock lost their try_lock, and is counting on us
+			process(s);
+			return true;
+		}
+
+		std::copy(data, data+length, arena_chunk(idx));
+		_arenaLengths[idx] = length;
+		sh.backlog.enqueue(idx);
+		process(s);
 		return true;
 	}
 
 	concurrent_fountain_decoder_sink& operator<<(const std::string& buffer)
 	{
-		_backlog.enqueue(buffer);
-		process();
+		write(buffer.data(), buffer.size());
 		return *this;
 	}
 
 protected:
-	std::mutex _writeMutex;
-	mutable std::mutex _readMutex;
-	fountain_decoder_sink _decoder;
-	moodycamel::ConcurrentQueue< std::string > _backlog;
+	struct shard
+	{
+		shard(unsigned chunk_size, const std::function<std::string(const std::string&, const std::vector<uint8_t>&)>& on_store)
+			: decoder(chunk_size, on_store)
+		{}
+
+		std::mutex writeMutex;
+		fountain_decoder_sink decoder;
+		moodycamel::ConcurrentQueue<unsigned> backlog;
 
-	std::vector<std::string> _done;
-	std::vector<double> _progress;
+		// copies of the decoder's status, under _readMutex
+		unsigned numStreams = 0;
+		std::vector<std::string> done;
+		std::vector<double> progress;
+	};
+
+	static unsigned shard_for(const char* data, unsigned length)
+	{
+		// too short to have a header? The decoder will reject it, wherever it goes.
+		if (length < FountainMetadata::md_size)
+			return 0;
+		return FountainMetadata(data, length).encode_id() % NUM_SHARDS;
+	}
+
+	char* arena_chunk(unsigned idx)
+	{
+		return _arena.data() + (idx * _chunkSize);
+	}
+
+	void update_status(shard& sh)
+	{
+		// we call this under the shard's writeMutex, to read its decoder.
+		// the aggregate getters only take readMutex.
+		std::lock_guard<std::mutex> lock(_readMutex);
+		sh.numStreams = sh.decoder.num_streams();
+		sh.done = sh.decoder.get_done();
+		sh.progress = sh.decoder.get_progress();
+	}
+
+protected:
+	unsigned _chunkSize;
+	std::array<std::unique_ptr<shard>, NUM_SHARDS> _shards;
+
+	std::vector<char> _arena;
+	std::vector<unsigned> _arenaLengths;
+	moodycamel::ConcurrentQueue<unsigned> _free;
+
+	mutable std::mutex _readMutex;
 };
@@ -7,6 +7,7 @@
 #include "compression/zstd_header_check.h"
 #include "serialize/format.h"
 #include "util/File.h"
+#include "util/stage_metrics.h"
 
 #include <cstdio>
 #include <filesystem>
@@ -78,6 +79,7 @@ public:
 	{
 		if (_onStore)
 		{
+			stage_timer t(stage_metrics::STORE);
 			auto res = s.recover();
 			if (!res)
 				return false;
@@ -153,7 +155,11 @@ public:
 		if (s.data_size() != md.file_size())
 			return -12;
 
-		bool finished = s.write(data, size);
+		bool finished;
+		{
+			stage_timer t(stage_metrics::FOUNTAIN_INGEST);
+			finished = s.write(data, size);
+		}
 		if (!finished)
 			return 0;
 
@@ -0,0 +1,173 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainMetadata.h"
+#include "fountain_encoder_stream.h"
+#include "concurrent_fountain_decoder_sink.h"
+
+#include "serialize/str_join.h"
+#include "util/File.h"
+#include "util/MakeTempDirectory.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using namespace std;
+
+namespace {
+	stringstream dummyContents(unsigned size)
+	{
+		stringstream input;
+		for (unsigned i = 0; i < (size/10); ++i)
+			input << "0123456789";
+		return input;
+	}
+
+	// one chunk per entry, as aligned_stream would hand them over
+	vector<string> createChunks(uint8_t encode_id, unsigned size, unsigned count)
+	{
+		stringstream input = dummyContents(size);
+		fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(input, 690, encode_id);
+
+		vector<string> chunks;
+		std::array<char, 690> buff;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			unsigned res = fes->readsome(buff.data(), buff.size());
+			assertEquals( res, buff.size() );
+			chunks.push_back(string(buff.data(), buff.size()));
+		}
+		return chunks;
+	}
+
+	class TestableSink : public concurrent_fountain_decoder_sink
+	{
+	public:
+		using concurrent_fountain_decoder_sink::concurrent_fountain_decoder_sink;
+
+		size_t backlog() const
+		{
+			size_t total = 0;
+			for (const auto& sh : _shards)
+				total += sh->backlog.size_approx();
+			return total;
+		}
+
+		size_t free_chunks() const
+		{
+			return _free.size_approx();
+		}
+
+		std::mutex& shard_mutex(unsigned s)
+		{
+			return _shards[s]->writeMutex;
+		}
+	};
+}
+
+TEST_CASE( "concurrent_fountain_decoder_sinkTest/testInterleavedFiles", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	concurrent_fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()), 16);
+
+	// 4 files, 4 writers. Every writer touches every file.
+	vector<vector<string>> files;
+	for (uint8_t id = 0; id < 4; ++id)
+		files.push_back(createChunks(id, 5000 + id*1000, 20));
+
+	vector<std::thread> writers;
+	for (unsigned w = 0; w < 4; ++w)
+		writers.emplace_back([&, w] () {
+			for (unsigned i = w; i < 20; i += 4)
+				for (const vector<string>& chunks : files)
+					sink << chunks[i];
+		});
+	for (std::thread& t : writers)
+		t.join();
+
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( 4, sink.num_done() );
+
+	vector<string> done = sink.get_done();
+	std::sort(done.begin(), done.end());
+	assertEquals( "0.5000 1.6000 2.7000 3.8000", turbo::str::join(done) );
+
+	for (unsigned id = 0; id < 4; ++id)
+	{
+		string contents = File(tempdir.path() / fmt::format("{}.{}", id, 5000 + id*1000)).read_all();
+		assertEquals( 5000 + id*1000, contents.size() );
+	}
+}
+
+TEST_CASE( "concurrent_fountain_decoder_sinkTest/testArenaExhausted", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	// no arena at all: every write goes straight to its shard
+	concurrent_fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()), 0);
+
+	vector<string> chunks = createChunks(5, 3000, 10);
+	for (const string& chunk : chunks)
+		sink << chunk;
+
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( "5.3000", turbo::str::join(sink.get_done()) );
+	assertEquals( "", turbo::str::join(sink.get_progress()) );
+}
+
+TEST_CASE( "concurrent_fountain_decoder_sinkTest/testArenaFullDrains", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	// a tiny arena, so writers keep falling back to decoding directly while others stage chunks on the same shard
+	TestableSink sink(690, write_on_store<std::ofstream>(tempdir.path()), 2);
+
+	vector<string> chunks = createChunks(3, 20000, 48);
+
+	vector<std::thread> writers;
+	for (unsigned w = 0; w < 6; ++w)
+		writers.emplace_back([&, w] () {
+			for (unsigned i = w; i < chunks.size(); i += 6)
+				sink << chunks[i];
+		});
+	for (std::thread& t : writers)
+		t.join();
+
+	// nothing left behind once the writers are gone
+	assertEquals( 0, sink.backlog() );
+	assertEquals( 2, sink.free_chunks() );
+
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( "3.20000", turbo::str::join(sink.get_done()) );
+	assertEquals( 20000, File(tempdir.path() / "3.20000").read_all().size() );
+}
+
+TEST_CASE( "concurrent_fountain_decoder_sinkTest/testDirectWriteDrainsBacklog", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	TestableSink sink(690, write_on_store<std::ofstream>(tempdir.path()), 1);
+	vector<string> chunks = createChunks(2, 3000, 10);
+
+	// someone is busy on the shard while a chunk is staged: it takes the only arena slot and stays in the backlog
+	{
+		std::lock_guard<std::mutex> lock(sink.shard_mutex(2));
+		std::thread([&] () { sink << chunks[0]; }).join();
+	}
+	assertEquals( 1, sink.backlog() );
+	assertEquals( 0, sink.free_chunks() );
+
+	// the rest can't be staged, so they're decoded directly. The first of them picks up the backlog on the way out
+	for (unsigned i = 1; i < chunks.size(); ++i)
+		sink << chunks[i];
+	assertEquals( 0, sink.backlog() );
+	assertEquals( 1, sink.free_chunks() );
+
+	assertEquals( "2.3000", turbo::str::join(sink.get_done()) );
+}
@@ -57,20 +57,53 @@ public:
 		unsigned _i;
 	};
 
+	static constexpr unsigned READLEN = CELLSIZE+2;
+	using rows_type = std::array<unsigned, READLEN>;
+
 public:
 	ahash_result(const intx::uint128& bits, unsigned mode=ALL)
-		: _bits(bits)
-		, _mode(mode)
+		: _mode(mode)
 	{
 		if (mode == ALL)
-			_results = extract_all();
+			_results = extract_all(bits);
 		else
-			_results = extract_fast();
+			_results = extract_fast(bits);
+	}
+
+	// one READLEN bit row per entry, leftmost pixel in the high bit. Same results as the uint128 version, without the 128 bit shifts.
+	ahash_result(const rows_type& rows, unsigned mode=ALL)
+		: _mode(mode)
+		, _results{}
+	{
+		_results[1] = extract_rows<1>(rows);
+		_results[3] = extract_rows<3>(rows);
+		_results[4] = extract_rows<4>(rows);
+		_results[5] = extract_rows<5>(rows);
+		_results[7] = extract_rows<7>(rows);
+		if (mode == ALL)
+		{
+			_results[0] = extract_rows<0>(rows);
+			_results[2] = extract_rows<2>(rows);
+			_results[6] = extract_rows<6>(rows);
+			_results[8] = extract_rows<8>(rows);
+		}
+	}
+
+	template <unsigned ID>
+	static uint64_t extract_rows(const rows_type& rows)
+	{
+		// ID%3 is the column drift, ID/3 the row drift. See bit_extractor::pattern()
+		constexpr uint64_t mask = (1 << CELLSIZE) - 1;
+		constexpr unsigned shift = 2 - ID%3;
+		uint64_t res = 0;
+		for (unsigned r = ID/3; r < ID/3 + CELLSIZE; ++r)
+			res = (res << CELLSIZE) | ((rows[r] >> shift) & mask);
+		return res;
 	}
 
-	std::array<uint64_t, 9> extract_all() const
+	static std::array<uint64_t, 9> extract_all(const intx::uint128& bits)
 	{
-		bit_extractor<intx::uint128, CELLAREA, CELLSIZE> be(_bits);
+		bit_extractor<intx::uint128, CELLAREA, CELLSIZE> be(bits);
 		return {
 			// top row -- top left bit is the start bit (0). bottom right is end bit.
 			be.extract_tuple( be.pattern(0) ), // left
@@ -87,9 +120,9 @@ public:
 		};
 	}
 
-	std::array<uint64_t, 9> extract_fast() const
+	static std::array<uint64_t, 9> extract_fast(const intx::uint128& bits)
 	{
-		bit_extractor<intx::uint128, CELLAREA, CELLSIZE> be(_bits);
+		bit_extractor<intx::uint128, CELLAREA, CELLSIZE> be(bits);
 		// skip the corners
 		return {
 			0,
@@ -127,7 +160,6 @@ public:
 	}
 
 protected:
-	intx::uint128 _bits;
 	int _mode;
 	std::array<uint64_t, 9> _results;
 };
@@ -0,0 +1,100 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "ahash_result.h"
+#include "bit_file/bitbuffer.h"
+#include "bit_file/bitplane.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace image_hash
+{
+	// the CELLSIZE+2 rows of the symbol grid that a row of cells sits in, repacked into 64 bit words.
+	// (the grid's rows start wherever the previous one ended, so they usually aren't byte aligned -- let alone word aligned)
+	// unpacking happens once for the whole strip. After that, each cell's rows are a shift or two away.
+	template <unsigned CELLSIZE>
+	class ahash_strip
+	{
+	public:
+		static constexpr unsigned READLEN = CELLSIZE+2;
+
+	public:
+		ahash_strip(const bitbuffer& grid, unsigned width, unsigned y)
+			: _rows(width, READLEN)
+		{
+			const std::vector<char>& bytes = grid.buffer();
+			for (unsigned r = 0; r < READLEN; ++r)
+			{
+				uint64_t* words = _rows.row(r);
+				size_t start = (size_t)(y + r) * width;
+				for (unsigned w = 0; w < _rows.words_per_row(); ++w)
+					words[w] = load(bytes, start + w*64);
+
+				// don't let the next row bleed into the padding
+				if (width % 64)
+					words[_rows.words_per_row() - 1] &= ~0ULL << (64 - width % 64);
+			}
+		}
+
+		ahash_result<CELLSIZE> operator()(unsigned x, unsigned mode=ahash_result<CELLSIZE>::ALL) const
+		{
+			typename ahash_result<CELLSIZE>::rows_type rows;
+			const unsigned word = x >> 6;
+			const unsigned offset = x & 63;
+			for (unsigned r = 0; r < READLEN; ++r)
+			{
+				const uint64_t* words = _rows.row(r);
+				uint64_t bits = words[word] << offset;
+				if (offset + READLEN > 64)
+					bits |= words[word + 1] >> (64 - offset);
+				rows[r] = bits >> (64 - READLEN);
+			}
+			return ahash_result<CELLSIZE>(rows, mode);
+		}
+
+	protected:
+		// 64 bits starting at bit pos, msb first. Past the end of the buffer is 0s.
+		static uint64_t load(const std::vector<char>& bytes, size_t pos)
+		{
+			size_t byte = pos / 8;
+			unsigned shift = pos % 8;
+			uint64_t res = 0;
+			if (byte + 8 <= bytes.size())
+			{
+				std::memcpy(&res, bytes.data() + byte, sizeof(res));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				res = __builtin_bswap64(res);
+#endif
+			}
+			else
+				for (unsigned i = 0; i < 8; ++i)
+					res = (res << 8) | at(bytes, byte + i);
+			if (shift)
+				res = (res << shift) | (at(bytes, byte + 8) >> (8 - shift));
+			return res;
+		}
+
+		static uint64_t at(const std::vector<char>& bytes, size_t i)
+		{
+			return i < bytes.size()? static_cast<uint8_t>(bytes[i]) : 0;
+		}
+
+	protected:
+		bitplane _rows;
+	};
+
+	// the fuzzy ahashes of a row of cells: the ones whose (CELLSIZE+2)^2 windows have their top left corners at (xs[i], y).
+	// same results as calling fuzzy_ahash() with a bitmatrix for each one. `out` is cleared first -- reuse it between strips.
+	template <unsigned CELLSIZE>
+	inline void fuzzy_ahash_strip(const bitbuffer& grid, unsigned width, unsigned y, const std::vector<unsigned>& xs,
+								  std::vector<ahash_result<CELLSIZE>>& out, unsigned mode=ahash_result<CELLSIZE>::ALL)
+	{
+		ahash_strip<CELLSIZE> strip(grid, width, y);
+		out.clear();
+		out.reserve(xs.size());
+		for (unsigned x : xs)
+			out.push_back(strip(x, mode));
+	}
+}
@@ -62,14 +62,9 @@ namespace image_hash
 	template <unsigned CELLSIZE>
 	inline ahash_result<CELLSIZE> fuzzy_ahash(const bitmatrix& img, unsigned mode=ahash_result<CELLSIZE>::ALL)
 	{
-		const unsigned readlen = CELLSIZE+2;
-		intx::uint128 res(0);
-		int bitpos = readlen*readlen - readlen; // 7*7 - 7 ..
-		for (unsigned i = 0; i < readlen; ++i, bitpos-=readlen)
-		{
-			intx::uint128 r = img.get(0, i, readlen);
-			res |= r << bitpos;
-		}
-		return ahash_result<CELLSIZE>(res, mode);
+		typename ahash_result<CELLSIZE>::rows_type rows;
+		for (unsigned i = 0; i < rows.size(); ++i)
+			rows[i] = img.get(0, i, rows.size());
+		return ahash_result<CELLSIZE>(rows, mode);
 	}
 }
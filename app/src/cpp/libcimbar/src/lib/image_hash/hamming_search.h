@@ -0,0 +1,124 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "hamming_distance.h"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_HASH_HAVE_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define IMAGE_HASH_HAVE_NEON 1
+#endif
+
+// which of n candidate hashes is closest to h?
+// the answer is packed as (distance << 8) | index, so the smallest key is the smallest distance -- and on a tie, the lowest index.
+// (that's what a linear scan with a strict `<` would pick.) n must be <= 256.
+// the vector kernels get a key for every candidate, then take the min. On x86, AVX2 is picked at runtime.
+namespace image_hash
+{
+	inline unsigned nearest_scalar(uint64_t h, const uint64_t* hashes, unsigned n)
+	{
+		unsigned best = ~0U;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			unsigned key = (hamming_distance(h, hashes[i]) << 8) | i;
+			if (key < best)
+				best = key;
+		}
+		return best;
+	}
+
+#ifdef IMAGE_HASH_HAVE_AVX2
+	__attribute__((target("avx2")))
+	inline unsigned nearest_avx2(uint64_t h, const uint64_t* hashes, unsigned n)
+	{
+		// popcount = nibble lookups, summed per 64 bit lane by sad
+		const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		const __m256i hv = _mm256_set1_epi64x(h);
+
+		// keys fit in the low 32 bits of each lane, so a 32 bit min works -- as long as the high halves can never win
+		const long long high = 0xFFFFFFFF00000000LL;
+		__m256i idx = _mm256_setr_epi64x(high | 0, high | 1, high | 2, high | 3);
+		const __m256i four = _mm256_set1_epi64x(4);
+		__m256i best = _mm256_set1_epi32(-1);
+
+		unsigned i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hashes + i)), hv);
+			__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, nibble));
+			__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+			__m256i dist = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+			best = _mm256_min_epu32(best, _mm256_or_si256(_mm256_slli_epi64(dist, 8), idx));
+			idx = _mm256_add_epi64(idx, four);
+		}
+
+		__m128i m = _mm_min_epu32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+		m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+		unsigned res = _mm_cvtsi128_si32(m);
+
+		for (; i < n; ++i)
+		{
+			unsigned key = (hamming_distance(h, hashes[i]) << 8) | i;
+			if (key < res)
+				res = key;
+		}
+		return res;
+	}
+#endif
+
+#ifdef IMAGE_HASH_HAVE_NEON
+	inline unsigned nearest_neon(uint64_t h, const uint64_t* hashes, unsigned n)
+	{
+		const uint64x2_t hv = vdupq_n_u64(h);
+		// as above: the high halves of each key are all 1s, so the 32 bit min only sees the low ones
+		const uint64_t start[2] = {0xFFFFFFFF00000000ULL | 0, 0xFFFFFFFF00000000ULL | 1};
+		uint64x2_t idx = vld1q_u64(start);
+		const uint64x2_t two = vdupq_n_u64(2);
+		uint32x4_t best = vdupq_n_u32(~0U);
+
+		unsigned i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			uint8x16_t x = vreinterpretq_u8_u64(veorq_u64(vld1q_u64(hashes + i), hv));
+			uint64x2_t dist = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(x))));
+			uint64x2_t key = vorrq_u64(vshlq_n_u64(dist, 8), idx);
+			best = vminq_u32(best, vreinterpretq_u32_u64(key));
+			idx = vaddq_u64(idx, two);
+		}
+		unsigned res = vminvq_u32(best);
+
+		for (; i < n; ++i)
+		{
+			unsigned key = (hamming_distance(h, hashes[i]) << 8) | i;
+			if (key < res)
+				res = key;
+		}
+		return res;
+	}
+#endif
+
+	using nearest_fun = unsigned (*)(uint64_t, const uint64_t*, unsigned);
+
+	inline nearest_fun pick_nearest()
+	{
+#if defined(IMAGE_HASH_HAVE_AVX2)
+		if (__builtin_cpu_supports("avx2"))
+			return nearest_avx2;
+#elif defined(IMAGE_HASH_HAVE_NEON)
+		return nearest_neon;
+#endif
+		return nearest_scalar;
+	}
+
+	inline unsigned nearest(uint64_t h, const uint64_t* hashes, unsigned n)
+	{
+		static const nearest_fun fun = pick_nearest();
+		return fun(h, hashes, n);
+	}
+}
@@ -0,0 +1,104 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "hamming_search.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// multi-index hashing over a fixed set of (up to 256) 64 bit hashes.
+// each hash is split into 8 bytes. If a hash is d bits away from the query, then at some byte position it is at most d/8 bits away.
+// so for each byte position and byte value, we precompute which hashes are within radius 0 (and 1) of that byte -- as a bitmask.
+// OR those together for the query's 8 bytes, and we have every hash within 7 (or 15) bits. If the best candidate is inside that
+// radius, nothing else can beat it (or tie it). Otherwise we fall back to the scan.
+// results are packed like image_hash::nearest(): (distance << 8) | index.
+// CimbDecoder only uses it when asked to (useIndex): whether it beats the SIMD scan depends on the machine, and on how far the
+// queries are from their tile -- at ~12 bits off, it's slower everywhere. Check the nearest_scan/nearest_index kernels in cimbar_bench first.
+namespace image_hash
+{
+	class hash_index
+	{
+	protected:
+		static constexpr unsigned CHUNKS = 8;
+		static constexpr unsigned RADII = 2;
+
+	public:
+		hash_index() = default;
+
+		explicit hash_index(const std::vector<uint64_t>& hashes)
+			: _hashes(hashes)
+			, _words((hashes.size() + 63) / 64)
+			, _balls(RADII * CHUNKS * 256 * _words, 0)
+		{
+			for (unsigned c = 0; c < CHUNKS; ++c)
+				for (unsigned i = 0; i < _hashes.size(); ++i)
+				{
+					unsigned v = chunk(_hashes[i], c);
+					uint64_t bit = 1ULL << (i & 63);
+					ball(0, c, v)[i >> 6] |= bit;
+					ball(1, c, v)[i >> 6] |= bit;
+					for (unsigned b = 0; b < 8; ++b)
+						ball(1, c, v ^ (1 << b))[i >> 6] |= bit;
+				}
+		}
+
+		unsigned nearest(uint64_t h) const
+		{
+			uint64_t seen[4] = {};
+			unsigned best = ~0U;
+			for (unsigned r = 0; r < RADII; ++r)
+			{
+				for (unsigned w = 0; w < _words; ++w)
+				{
+					uint64_t candidates = 0;
+					for (unsigned c = 0; c < CHUNKS; ++c)
+						candidates |= ball(r, c, chunk(h, c))[w];
+					candidates &= ~seen[w];
+					seen[w] |= candidates;
+
+					for (; candidates; candidates &= candidates - 1)
+					{
+						unsigned i = w*64 + __builtin_ctzll(candidates);
+						unsigned key = (hamming_distance(h, _hashes[i]) << 8) | i;
+						best = std::min(best, key);
+					}
+				}
+
+				if ((best >> 8) < CHUNKS * (r+1))
+					return best;
+			}
+			return image_hash::nearest(h, _hashes.data(), _hashes.size());
+		}
+
+		unsigned size() const
+		{
+			return _hashes.size();
+		}
+
+		bool empty() const
+		{
+			return _hashes.empty();
+		}
+
+	protected:
+		static unsigned chunk(uint64_t h, unsigned c)
+		{
+			return (h >> (c*8)) & 0xFF;
+		}
+
+		uint64_t* ball(unsigned r, unsigned c, unsigned v)
+		{
+			return _balls.data() + (((r*CHUNKS + c) * 256 + v) * _words);
+		}
+
+		const uint64_t* ball(unsigned r, unsigned c, unsigned v) const
+		{
+			return _balls.data() + (((r*CHUNKS + c) * 256 + v) * _words);
+		}
+
+	protected:
+		std::vector<uint64_t> _hashes;
+		unsigned _words = 0;
+		std::vector<uint64_t> _balls; // [radius][chunk][byte value] -> bitmask of hash indices
+	};
+}
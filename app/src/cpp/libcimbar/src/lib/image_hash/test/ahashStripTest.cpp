@@ -0,0 +1,73 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "ahash_strip.h"
+#include "average_hash.h"
+
+#include "bit_file/bitbuffer.h"
+#include "bit_file/bitmatrix.h"
+#include "intx/intx.hpp"
+#include <random>
+#include <vector>
+
+namespace {
+	bitbuffer random_grid(unsigned width, unsigned height, unsigned seed)
+	{
+		std::mt19937 gen(seed);
+		bitbuffer bb;
+		bitbuffer::writer writer(bb);
+		for (unsigned i = 0; i < width*height; i += 8)
+			writer << (uint8_t)gen();
+		return bb;
+	}
+
+	// the old way: one 128 bit number for the whole window
+	template <unsigned CELLSIZE>
+	image_hash::ahash_result<CELLSIZE> ahash_128(const bitbuffer& bb, unsigned width, unsigned x, unsigned y, unsigned mode)
+	{
+		const unsigned readlen = CELLSIZE+2;
+		intx::uint128 res(0);
+		int bitpos = readlen*readlen - readlen;
+		for (unsigned i = 0; i < readlen; ++i, bitpos-=readlen)
+			res |= intx::uint128(bb.read(x + (y+i)*width, readlen)) << bitpos;
+		return image_hash::ahash_result<CELLSIZE>(res, mode);
+	}
+
+	template <unsigned CELLSIZE>
+	void check_strip(unsigned width, unsigned height, unsigned mode)
+	{
+		bitbuffer bb = random_grid(width, height, width);
+		for (unsigned y = 0; y + CELLSIZE+2 <= height; y += 3)
+		{
+			std::vector<unsigned> xs;
+			for (unsigned x = 0; x + CELLSIZE+2 <= width; ++x)
+				xs.push_back(x);
+
+			std::vector<image_hash::ahash_result<CELLSIZE>> strip;
+			image_hash::fuzzy_ahash_strip<CELLSIZE>(bb, width, y, xs, strip, mode);
+			assertEquals( xs.size(), strip.size() );
+			for (unsigned i = 0; i < xs.size(); ++i)
+			{
+				auto expected = ahash_128<CELLSIZE>(bb, width, xs[i], y, mode);
+				auto single = image_hash::fuzzy_ahash<CELLSIZE>(bitmatrix(bb, width, height, xs[i], y), mode);
+				for (unsigned d = 0; d < 9; ++d)
+				{
+					assertEquals( expected[d], strip[i][d] );
+					assertEquals( expected[d], single[d] );
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE( "ahashStripTest/testStrip8", "[unit]" )
+{
+	check_strip<8>(200, 30, image_hash::ahash_result<8>::ALL);
+	check_strip<8>(133, 12, image_hash::ahash_result<8>::FAST);
+}
+
+TEST_CASE( "ahashStripTest/testStrip5", "[unit]" )
+{
+	check_strip<5>(128, 20, image_hash::ahash_result<5>::ALL);
+	check_strip<5>(71, 9, image_hash::ahash_result<5>::FAST);
+}
@@ -0,0 +1,66 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "hamming_search.h"
+#include <random>
+#include <vector>
+
+namespace {
+	// the loop hamming_search replaces: strict <, so the first of a tie wins
+	unsigned nearest_reference(uint64_t h, const std::vector<uint64_t>& hashes, unsigned& best_distance)
+	{
+		unsigned best_fit = 0;
+		best_distance = 1000;
+		for (unsigned i = 0; i < hashes.size(); ++i)
+		{
+			unsigned distance = image_hash::hamming_distance(h, hashes[i]);
+			if (distance < best_distance)
+			{
+				best_distance = distance;
+				best_fit = i;
+			}
+		}
+		return best_fit;
+	}
+}
+
+TEST_CASE( "hammingSearchTest/testTies", "[unit]" )
+{
+	std::vector<uint64_t> hashes = {0xFF, 0x0F, 0xF0, 0x0F, 0xF0};
+	// 0x0F and 0xF0 are both 4 away from 0. The first one wins.
+	assertEquals( (4 << 8) | 1, image_hash::nearest(0, hashes.data(), hashes.size()) );
+	assertEquals( (0 << 8) | 2, image_hash::nearest(0xF0, hashes.data(), hashes.size()) );
+	assertEquals( (0 << 8) | 0, image_hash::nearest(0xFF, hashes.data(), 1) );
+}
+
+TEST_CASE( "hammingSearchTest/testMatchesScan", "[unit]" )
+{
+	std::mt19937_64 gen(1337);
+	for (unsigned n : {1, 3, 4, 7, 16, 17, 64, 128, 256})
+	{
+		for (unsigned trial = 0; trial < 200; ++trial)
+		{
+			std::vector<uint64_t> hashes(n);
+			for (uint64_t& hash : hashes)
+				hash = gen();
+			// sometimes copies, so there are exact matches and ties
+			if (trial % 3 == 0)
+				hashes[gen() % n] = hashes[gen() % n];
+			uint64_t h = (trial % 2)? hashes[gen() % n] ^ (1ULL << (gen() % 64)) : gen();
+
+			unsigned best_distance;
+			unsigned best_fit = nearest_reference(h, hashes, best_distance);
+			unsigned expected = (best_distance << 8) | best_fit;
+
+			assertEquals( expected, image_hash::nearest_scalar(h, hashes.data(), n) );
+			assertEquals( expected, image_hash::nearest(h, hashes.data(), n) );
+#ifdef IMAGE_HASH_HAVE_AVX2
+			if (__builtin_cpu_supports("avx2"))
+				assertEquals( expected, image_hash::nearest_avx2(h, hashes.data(), n) );
+#endif
+#ifdef IMAGE_HASH_HAVE_NEON
+			assertEquals( expected, image_hash::nearest_neon(h, hashes.data(), n) );
+#endif
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "hash_index.h"
+#include <random>
+#include <vector>
+
+TEST_CASE( "hashIndexTest/testEmpty", "[unit]" )
+{
+	image_hash::hash_index index;
+	assertTrue( index.empty() );
+	assertEquals( 0, index.size() );
+}
+
+TEST_CASE( "hashIndexTest/testRadius", "[unit]" )
+{
+	// one bit off in every byte: 8 away, so the radius 0 lookup can't see it. Radius 1 can.
+	std::vector<uint64_t> hashes = {0, 0x0101010101010101ULL, 0xFFFFFFFFFFFFFFFFULL};
+	image_hash::hash_index index(hashes);
+	assertEquals( 3, index.size() );
+
+	assertEquals( (0 << 8) | 0, index.nearest(0) );
+	assertEquals( (1 << 8) | 1, index.nearest(0x0101010101010100ULL) );
+	assertEquals( (8 << 8) | 0, index.nearest(0x0202020202020202ULL) );
+	// and too far for either: the scan
+	assertEquals( (16 << 8) | 1, index.nearest(0x0707070707070707ULL) );
+}
+
+TEST_CASE( "hashIndexTest/testMatchesScan", "[unit]" )
+{
+	std::mt19937_64 gen(42);
+	for (unsigned n : {1, 2, 16, 63, 64, 65, 128, 256})
+	{
+		std::vector<uint64_t> hashes(n);
+		for (uint64_t& hash : hashes)
+			hash = gen();
+		// near duplicates, for ties
+		for (unsigned i = 1; i < n; i += 5)
+			hashes[i] = hashes[i-1] ^ (1ULL << (gen() % 64));
+
+		image_hash::hash_index index(hashes);
+		for (unsigned trial = 0; trial < 2000; ++trial)
+		{
+			uint64_t h = hashes[gen() % n];
+			for (unsigned flips = gen() % 32; flips > 0; --flips)
+				h ^= 1ULL << (gen() % 64);
+			assertEquals( image_hash::nearest_scalar(h, hashes.data(), n), index.nearest(h) );
+		}
+	}
+}
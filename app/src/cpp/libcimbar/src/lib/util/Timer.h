@@ -1,35 +1,44 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
-#include <ctime>
+#include "latency_histogram.h"
 
+#include <chrono>
+
+// wall time, in microseconds. One thread records, any thread can read.
 class TimeAccumulator
 {
 public:
 	TimeAccumulator()
 	{}
 
-	void increment(clock_t num)
+	void increment(uint64_t micros)
 	{
-		_total += num;
-		_ticks += 1;
+		_hist.record(micros);
 	}
 
 	double avg() const
 	{
-		if (_ticks == 0)
-			return 0;
-		return _total/_ticks;
+		return _hist.avg();
+	}
+
+	uint64_t ticks() const
+	{
+		return _hist.count();
+	}
+
+	uint64_t percentile(double p) const
+	{
+		return _hist.snapshot().percentile(p);
 	}
 
-	clock_t ticks() const
+	histogram_snapshot snapshot() const
 	{
-		return _ticks;
+		return _hist.snapshot();
 	}
 
 protected:
-	clock_t _total = 0;
-	clock_t _ticks = 0;
+	latency_histogram _hist;
 };
 
 class Timer
@@ -37,15 +46,15 @@ class Timer
 public:
 	Timer(TimeAccumulator& accum)
 		: _accum(accum)
-		, _start(clock())
+		, _start(std::chrono::steady_clock::now())
 	{}
 
 	~Timer()
 	{
-		_accum.increment(clock() - _start);
+		_accum.increment(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count());
 	}
 
 protected:
 	TimeAccumulator& _accum;
-	clock_t _start;
+	std::chrono::steady_clock::time_point _start;
 };
@@ -0,0 +1,191 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// log-linear buckets: exact below 8, then 8 sub-buckets per power of two (~12% resolution).
+// values are expected to be microseconds, and are clamped at 2^40 (~12 days).
+namespace latency_buckets
+{
+	static constexpr unsigned SUB_BITS = 3;
+	static constexpr unsigned SUB_BUCKETS = 1 << SUB_BITS;
+	static constexpr unsigned MAX_EXPONENT = 39;
+	static constexpr unsigned NUM_BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+	inline unsigned index(uint64_t val)
+	{
+		if (val < SUB_BUCKETS)
+			return val;
+		unsigned exp = 63 - __builtin_clzll(val);
+		if (exp > MAX_EXPONENT)
+			return NUM_BUCKETS - 1;
+		unsigned sub = (val >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+		return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+	}
+
+	inline uint64_t lower_bound(unsigned idx)
+	{
+		if (idx < SUB_BUCKETS)
+			return idx;
+		unsigned exp = idx / SUB_BUCKETS + SUB_BITS - 1;
+		uint64_t sub = idx % SUB_BUCKETS;
+		return (SUB_BUCKETS + sub) << (exp - SUB_BITS);
+	}
+
+	inline uint64_t width(unsigned idx)
+	{
+		if (idx < SUB_BUCKETS)
+			return 1;
+		unsigned exp = idx / SUB_BUCKETS + SUB_BITS - 1;
+		return uint64_t(1) << (exp - SUB_BITS);
+	}
+}
+
+// plain (non-atomic) copy of a histogram. Mergeable, and where the percentiles come from.
+class histogram_snapshot
+{
+public:
+	histogram_snapshot()
+	{
+		_buckets.fill(0);
+	}
+
+	void add(unsigned bucket, uint64_t count)
+	{
+		_buckets[bucket] += count;
+	}
+
+	void set_totals(uint64_t count, uint64_t total, uint64_t max)
+	{
+		_count = count;
+		_total = total;
+		_max = max;
+	}
+
+	histogram_snapshot& merge(const histogram_snapshot& other)
+	{
+		for (unsigned i = 0; i < _buckets.size(); ++i)
+			_buckets[i] += other._buckets[i];
+		_count += other._count;
+		_total += other._total;
+		_max = std::max(_max, other._max);
+		return *this;
+	}
+
+	uint64_t count() const
+	{
+		return _count;
+	}
+
+	uint64_t total() const
+	{
+		return _total;
+	}
+
+	uint64_t max() const
+	{
+		return _max;
+	}
+
+	double avg() const
+	{
+		if (_count == 0)
+			return 0;
+		return (double)_total / _count;
+	}
+
+	// p in [0, 1]. Returns the midpoint of the bucket the pth sample landed in.
+	uint64_t percentile(double p) const
+	{
+		uint64_t seen = 0;
+		for (uint64_t b : _buckets)
+			seen += b;
+		if (seen == 0)
+			return 0;
+
+		uint64_t rank = std::min<uint64_t>(seen - 1, seen * std::clamp(p, 0.0, 1.0));
+		seen = 0;
+		for (unsigned i = 0; i < _buckets.size(); ++i)
+		{
+			seen += _buckets[i];
+			if (seen > rank)
+				return std::min(_max, latency_buckets::lower_bound(i) + latency_buckets::width(i) / 2);
+		}
+		return _max;
+	}
+
+protected:
+	std::array<uint64_t, latency_buckets::NUM_BUCKETS> _buckets;
+	uint64_t _count = 0;
+	uint64_t _total = 0;
+	uint64_t _max = 0;
+};
+
+// lock-free recorder. There should be one writing thread per histogram
+// (see stage_metrics for the per-thread bookkeeping), but any thread can snapshot().
+class latency_histogram
+{
+public:
+	latency_histogram()
+	{
+		reset();
+	}
+
+	void record(uint64_t val)
+	{
+		bump(_buckets[latency_buckets::index(val)], 1);
+		bump(_count, 1);
+		bump(_total, val);
+		if (val > _max.load(std::memory_order_relaxed))
+			_max.store(val, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const
+	{
+		return _count.load(std::memory_order_relaxed);
+	}
+
+	double avg() const
+	{
+		uint64_t count = _count.load(std::memory_order_relaxed);
+		if (count == 0)
+			return 0;
+		return (double)_total.load(std::memory_order_relaxed) / count;
+	}
+
+	histogram_snapshot snapshot() const
+	{
+		histogram_snapshot snap;
+		for (unsigned i = 0; i < _buckets.size(); ++i)
+			snap.add(i, _buckets[i].load(std::memory_order_relaxed));
+		snap.set_totals(_count.load(std::memory_order_relaxed), _total.load(std::memory_order_relaxed), _max.load(std::memory_order_relaxed));
+		return snap;
+	}
+
+	// only safe while no one is recording
+	void reset()
+	{
+		for (std::atomic<uint32_t>& b : _buckets)
+			b.store(0, std::memory_order_relaxed);
+		_count.store(0, std::memory_order_relaxed);
+		_total.store(0, std::memory_order_relaxed);
+		_max.store(0, std::memory_order_relaxed);
+	}
+
+protected:
+	// single writer, so we can skip the locked read-modify-write
+	template <typename T>
+	static void bump(std::atomic<T>& a, uint64_t val)
+	{
+		a.store(a.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+	}
+
+protected:
+	std::array<std::atomic<uint32_t>, latency_buckets::NUM_BUCKETS> _buckets;
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _total;
+	std::atomic<uint64_t> _max;
+};
@@ -0,0 +1,143 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "latency_histogram.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// per-thread, per-stage latency histograms for the decode pipeline.
+// recording is lock-free: each thread writes only to its own slot, which it looks up once.
+// snapshot() merges every thread's slot.
+class stage_metrics
+{
+public:
+	enum stage {
+		SCAN,
+		DESKEW,
+		SYMBOL_DECODE,
+		COLOR_DECODE,
+		REED_SOLOMON,
+		FOUNTAIN_INGEST,
+		STORE,
+		NUM_STAGES
+	};
+
+	using snapshot_t = std::array<histogram_snapshot, NUM_STAGES>;
+
+public:
+	stage_metrics()
+		: _id(next_id())
+	{}
+
+	static stage_metrics& global()
+	{
+		static stage_metrics instance;
+		return instance;
+	}
+
+	static const char* stage_name(unsigned s)
+	{
+		static constexpr std::array<const char*, NUM_STAGES> names = {
+			"scan", "deskew", "symbol_decode", "color_decode", "reed_solomon", "fountain_ingest", "store"
+		};
+		return s < NUM_STAGES? names[s] : "?";
+	}
+
+	void record(stage s, uint64_t micros)
+	{
+		local().hists[s].record(micros);
+	}
+
+	snapshot_t snapshot() const
+	{
+		snapshot_t snap;
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto&& [tid, slot] : _slots)
+			for (unsigned s = 0; s < NUM_STAGES; ++s)
+				snap[s].merge(slot->hists[s].snapshot());
+		return snap;
+	}
+
+	histogram_snapshot snapshot(stage s) const
+	{
+		histogram_snapshot snap;
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto&& [tid, slot] : _slots)
+			snap.merge(slot->hists[s].snapshot());
+		return snap;
+	}
+
+	// only safe while nothing is recording, e.g. between benchmark runs
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto&& [tid, slot] : _slots)
+			for (latency_histogram& h : slot->hists)
+				h.reset();
+	}
+
+protected:
+	struct thread_slot
+	{
+		std::array<latency_histogram, NUM_STAGES> hists;
+	};
+
+	static uint64_t next_id()
+	{
+		static std::atomic<uint64_t> ids(1);
+		return ids++;
+	}
+
+	thread_slot& local()
+	{
+		// cache the most recently used instance per thread. Ids are never reused, so a stale entry can't alias.
+		thread_local uint64_t cachedId = 0;
+		thread_local thread_slot* cachedSlot = nullptr;
+		if (cachedId == _id)
+			return *cachedSlot;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::unique_ptr<thread_slot>& slot = _slots[std::this_thread::get_id()];
+		if (!slot)
+			slot = std::make_unique<thread_slot>();
+		cachedId = _id;
+		cachedSlot = slot.get();
+		return *slot;
+	}
+
+protected:
+	uint64_t _id;
+	mutable std::mutex _mutex;
+	std::unordered_map<std::thread::id, std::unique_ptr<thread_slot>> _slots;
+};
+
+class stage_timer
+{
+public:
+	stage_timer(stage_metrics::stage s, stage_metrics& metrics=stage_metrics::global())
+		: _metrics(metrics)
+		, _stage(s)
+		, _start(std::chrono::steady_clock::now())
+	{}
+
+	~stage_timer()
+	{
+		_metrics.record(_stage, elapsed());
+	}
+
+	uint64_t elapsed() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+protected:
+	stage_metrics& _metrics;
+	stage_metrics::stage _stage;
+	std::chrono::steady_clock::time_point _start;
+};
@@ -0,0 +1,70 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a few long lived threads and one shared queue. Enough for CimbReader::read_parallel() in the command line tools --
+// the app has its own (pinned) pool for that.
+// anything still queued when we go away is run before the threads exit.
+class worker_pool
+{
+public:
+	worker_pool(unsigned threads)
+	{
+		for (unsigned t = 0; t < threads; ++t)
+			_threads.emplace_back([this] () { run(); });
+	}
+
+	~worker_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopped = true;
+		}
+		_cv.notify_all();
+		for (std::thread& t : _threads)
+			t.join();
+	}
+
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+
+	void execute(std::function<void()> fun)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.push_back(std::move(fun));
+		}
+		_cv.notify_one();
+	}
+
+protected:
+	void run()
+	{
+		while (true)
+		{
+			std::function<void()> fun;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cv.wait(lock, [this] () { return _stopped or !_tasks.empty(); });
+				if (_tasks.empty())
+					return;
+				fun = std::move(_tasks.front());
+				_tasks.pop_front();
+			}
+			fun();
+		}
+	}
+
+protected:
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<std::function<void()>> _tasks;
+	bool _stopped = false;
+	std::vector<std::thread> _threads;
+};
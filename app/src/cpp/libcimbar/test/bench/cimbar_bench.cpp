@@ -0,0 +1,445 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "cimb_translator/Cell.h"
+#include "cimb_translator/CimbDecoder.h"
+#include "cimb_translator/CimbReader.h"
+#include "cimb_translator/Config.h"
+#include "cimb_translator/FloodDecodePositions.h"
+#include "cimb_translator/GridLayout.h"
+#include "compression/zstd_compressor.h"
+#include "compression/zstd_decompressor.h"
+#include "encoder/Encoder.h"
+#include "encoder/reed_solomon_stream.h"
+#include "extractor/Corners.h"
+#include "extractor/Deskewer.h"
+#include "extractor/PackedThreshold.h"
+#include "extractor/Scanner.h"
+#include "fountain/FountainInit.h"
+#include "fountain/fountain_decoder_stream.h"
+#include "fountain/fountain_encoder_stream.h"
+#include "image_hash/ahash_strip.h"
+#include "image_hash/average_hash.h"
+#include "image_hash/hamming_search.h"
+#include "image_hash/hash_index.h"
+#include "serialize/format.h"
+#include "util/ConfigScope.h"
+#include "util/latency_histogram.h"
+#include "util/worker_pool.h"
+
+#include "cxxopts/cxxopts.hpp"
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+// one json object per line, per (mode, kernel):
+// {"mode":"B","kernel":"scan","iterations":N,"ops_per_iter":1,"mean_ns":...,"p50_ns":...,"p90_ns":...,"p99_ns":...,"max_ns":...}
+// per-cell kernels (flood_positions, fuzzy_ahash, fuzzy_ahash_strip, get_best_symbol, mean_rgb) time a sweep over every cell in the frame; ops_per_iter is the cell count.
+// the nearest_scan/nearest_index kernels run once, not per mode: "mode" is the alphabet size (e.g. "64tiles").
+
+namespace {
+	using clock_type = std::chrono::steady_clock;
+
+	// keeps results alive so the optimizer can't throw the kernels away
+	volatile uint64_t _sink = 0;
+
+	struct BenchOptions
+	{
+		unsigned minIterations = 10;
+		double minSeconds = 0.5;
+		vector<string> kernels;
+	};
+
+	class Bench
+	{
+	public:
+		Bench(std::ostream& out, const BenchOptions& opts)
+			: _out(out)
+			, _opts(opts)
+		{}
+
+		bool enabled(const string& kernel) const
+		{
+			if (_opts.kernels.empty())
+				return true;
+			return std::find(_opts.kernels.begin(), _opts.kernels.end(), kernel) != _opts.kernels.end();
+		}
+
+		template <typename FUN>
+		void run(const string& mode, const string& kernel, unsigned ops_per_iter, FUN&& fun)
+		{
+			if (!enabled(kernel))
+				return;
+
+			fun(); // warm up
+
+			latency_histogram hist;
+			clock_type::time_point start = clock_type::now();
+			clock_type::time_point now = start;
+			while (hist.count() < _opts.minIterations or std::chrono::duration<double>(now - start).count() < _opts.minSeconds)
+			{
+				clock_type::time_point begin = clock_type::now();
+				fun();
+				now = clock_type::now();
+				hist.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - begin).count());
+			}
+
+			histogram_snapshot snap = hist.snapshot();
+			_out << fmt::format("{{\"mode\":\"{}\",\"kernel\":\"{}\",\"iterations\":{},\"ops_per_iter\":{},\"mean_ns\":{:.0f},\"p50_ns\":{},\"p90_ns\":{},\"p99_ns\":{},\"max_ns\":{}}}",
+								mode, kernel, snap.count(), ops_per_iter, snap.avg(), snap.percentile(.5), snap.percentile(.9), snap.percentile(.99), snap.max()) << std::endl;
+		}
+
+		void error(const string& mode, const string& kernel, const string& msg)
+		{
+			_out << fmt::format("{{\"mode\":\"{}\",\"kernel\":\"{}\",\"error\":\"{}\"}}", mode, kernel, msg) << std::endl;
+		}
+
+	protected:
+		std::ostream& _out;
+		const BenchOptions& _opts;
+	};
+
+	// compressible, but not trivially so
+	string synthetic_data(unsigned size)
+	{
+		static const vector<string> words = {"cimbar ", "camera ", "file ", "copy ", "fountain ", "symbol ", "color ", "anchor ", "\n"};
+		std::mt19937 gen(1234);
+		std::uniform_int_distribution<unsigned> pick(0, words.size() - 1);
+		std::uniform_int_distribution<unsigned> byte(0, 255);
+
+		string data;
+		while (data.size() < size)
+		{
+			data += words[pick(gen)];
+			data += (char)byte(gen);
+		}
+		data.resize(size);
+		return data;
+	}
+
+	// the encoded frame, scaled and padded like it would be in a camera frame
+	cv::Mat camera_frame(const cv::Mat& frame)
+	{
+		cv::Mat img;
+		cv::resize(frame, img, cv::Size(), 1.5, 1.5, cv::INTER_LINEAR);
+		int border = img.rows / 8;
+		cv::copyMakeBorder(img, img, border, border, border*2, border*2, cv::BORDER_CONSTANT, cv::Scalar(100, 100, 100));
+		return img;
+	}
+
+	void bench_mode(Bench& bench, const string& modeName, int modeVal, const string& data)
+	{
+		ConfigScope cs(modeVal);
+
+		// compressed payload, for the zstd + fountain kernels
+		string compressed;
+		{
+			std::stringstream raw(data);
+			cimbar::zstd_compressor<std::stringstream> f;
+			f.compress(raw, cimbar::Config::compression_level());
+			compressed = f.str();
+		}
+
+		// encoded frame
+		cv::Mat frame;
+		{
+			Encoder enc;
+			enc.set_encode_id(42);
+			std::stringstream input(data);
+			fountain_encoder_stream::ptr fes = enc.create_fountain_encoder(input, "bench.txt", cimbar::Config::compression_level());
+			if (!fes)
+				return bench.error(modeName, "encode", "no fountain encoder");
+			std::optional<cv::Mat> res = enc.encode_next(*fes);
+			if (!res)
+				return bench.error(modeName, "encode", "no frame");
+			frame = *res;
+		}
+
+		cv::Mat camera = camera_frame(frame);
+		bench.run(modeName, "threshold", 1, [&]() {
+			bitplane bits;
+			PackedThreshold::threshold(camera, bits);
+			_sink += bits.row(0)[0];
+		});
+		bench.run(modeName, "threshold_3pass", 1, [&]() {
+			cv::Mat bits = Scanner::preprocess_image(camera, true);
+			_sink += bits.rows;
+		});
+
+		std::vector<Anchor> anchors;
+		bench.run(modeName, "scan", 1, [&]() {
+			Scanner scanner(camera);
+			anchors = scanner.scan();
+			_sink += anchors.size();
+		});
+
+		bench.run(modeName, "scan_4bands", 1, [&]() {
+			Scanner scanner(camera);
+			_sink += scanner.scan(4).size();
+		});
+
+		cv::Mat deskewed = frame;
+		if (anchors.size() < 4)
+		{
+			Scanner scanner(camera);
+			anchors = scanner.scan();
+		}
+		if (anchors.size() >= 4)
+		{
+			Corners corners(anchors);
+			Deskewer de;
+			bench.run(modeName, "deskew", 1, [&]() {
+				deskewed = de.deskew(camera, corners);
+				_sink += deskewed.rows;
+			});
+
+			// every symbol in the frame: deskew + threshold the whole grid first, vs. sampling each cell from the camera frame
+			cv::Mat transform = de.get_transform(corners);
+			CimbDecoder decoder(cimbar::Config::symbol_bits(), cimbar::Config::color_bits(), cimbar::Config::dark(), 0xFF);
+			bench.run(modeName, "read_symbols", 1, [&]() {
+				CimbReader reader(de.deskew(camera, corners), decoder, cimbar::Config::color_mode());
+				PositionData pos;
+				while (!reader.done())
+					_sink += reader.read(pos);
+			});
+			// long lived helpers, like the app's -- so this times the reads, not thread startup
+			worker_pool pool(3);
+			CimbReader::executor execute = [&pool] (std::function<void()> fun) { pool.execute(std::move(fun)); };
+			bench.run(modeName, "read_symbols_parallel", 1, [&]() {
+				CimbReader reader(de.deskew(camera, corners), decoder, cimbar::Config::color_mode());
+				for (auto&& [pos, bits] : reader.read_parallel(execute, 3))
+					_sink += bits;
+			});
+			bench.run(modeName, "read_symbols_direct", 1, [&]() {
+				CimbReader reader(camera, transform, decoder, cimbar::Config::color_mode());
+				PositionData pos;
+				while (!reader.done())
+					_sink += reader.read(pos);
+			});
+		}
+		else
+			bench.error(modeName, "deskew", "no anchors");
+
+		bitbuffer grid = CimbReader::preprocess_symbol_grid(deskewed);
+		bench.run(modeName, "preprocess_symbol_grid", 1, [&]() {
+			grid = CimbReader::preprocess_symbol_grid(deskewed);
+			_sink += grid.buffer().size();
+		});
+
+		// cell positions, straight from the config (no drift)
+		constexpr unsigned cellSize = cimbar::Config::cell_size();
+		std::shared_ptr<const GridLayout> layout = GridLayout::get();
+
+		// what every frame used to pay for its positions, flood regions and interleave tables. vs what it pays now
+		bench.run(modeName, "grid_layout_build", 1, [&]() {
+			GridLayout fresh(layout->layout_params());
+			_sink += fresh.interleave_lookup().back();
+		});
+		bench.run(modeName, "flood_setup", 1, [&]() {
+			FloodDecodePositions fdp(GridLayout::get());
+			_sink += fdp.size();
+		});
+
+		FloodDecodePositions fdp(layout);
+		const CellPositions::positions_list& positions = fdp.positions();
+
+		// just the decode order bookkeeping: a fake error per cell stands in for the decode
+		bench.run(modeName, "flood_positions", positions.size(), [&]() {
+			fdp.reset();
+			while (!fdp.done())
+			{
+				auto [i, xy, drift, cooldown] = fdp.next();
+				unsigned error = (i * 2654435761U >> 7) % 9;
+				fdp.update(i, drift, error, CellDrift::calculate_cooldown(cooldown, error%3? 4 : 1));
+				_sink += xy.first;
+			}
+		});
+
+		vector<image_hash::ahash_result<cellSize>> hashes;
+		hashes.reserve(positions.size());
+		for (auto [x, y] : positions)
+			hashes.push_back(image_hash::fuzzy_ahash<cellSize>(bitmatrix(grid, deskewed.cols, deskewed.rows, x-1, y-1)));
+
+		bench.run(modeName, "fuzzy_ahash", positions.size(), [&]() {
+			for (auto [x, y] : positions)
+			{
+				bitmatrix cell(grid, deskewed.cols, deskewed.rows, x-1, y-1);
+				_sink += image_hash::fuzzy_ahash<cellSize>(cell)[4];
+			}
+		});
+
+		// the same cells, a row at a time
+		std::map<unsigned, vector<unsigned>> rows;
+		for (auto [x, y] : positions)
+			rows[y-1].push_back(x-1);
+		vector<image_hash::ahash_result<cellSize>> strip;
+		bench.run(modeName, "fuzzy_ahash_strip", positions.size(), [&]() {
+			for (const auto& [y, xs] : rows)
+			{
+				image_hash::fuzzy_ahash_strip<cellSize>(grid, deskewed.cols, y, xs, strip);
+				for (const auto& h : strip)
+					_sink += h[4];
+			}
+		});
+
+		CimbDecoder decoder(cimbar::Config::symbol_bits(), cimbar::Config::color_bits(), cimbar::Config::dark(), 0xFF);
+		bench.run(modeName, "get_best_symbol", positions.size(), [&]() {
+			for (const auto& h : hashes)
+			{
+				image_hash::ahash_result<cellSize> res = h;
+				unsigned drift = 0;
+				unsigned distance = 0;
+				_sink += decoder.get_best_symbol(res, drift, distance);
+			}
+		});
+
+		bench.run(modeName, "mean_rgb", positions.size(), [&]() {
+			for (auto [x, y] : positions)
+			{
+				Cell cell(deskewed, x+1, y+1, cellSize-2, cellSize-2);
+				_sink += std::get<0>(cell.mean_rgb());
+			}
+		});
+
+		// one frame's worth of RS blocks
+		string encodedBlocks;
+		{
+			std::stringstream src(data);
+			reed_solomon_stream<std::stringstream> rss(src, cimbar::Config::ecc_bytes(), cimbar::Config::ecc_block_size());
+			unsigned frameBytes = cimbar::Config::capacity(cimbar::Config::bits_per_cell());
+			while (encodedBlocks.size() + cimbar::Config::ecc_block_size() <= frameBytes)
+			{
+				std::streamsize bytes = rss.readsome();
+				if (bytes <= 0)
+					break;
+				encodedBlocks.append(rss.buffer(), bytes);
+			}
+		}
+		bench.run(modeName, "reed_solomon_write", encodedBlocks.size() / cimbar::Config::ecc_block_size(), [&]() {
+			std::stringstream out;
+			reed_solomon_stream<std::stringstream> rss(out, cimbar::Config::ecc_bytes(), cimbar::Config::ecc_block_size());
+			rss.write(encodedBlocks.data(), encodedBlocks.size());
+			_sink += out.tellp();
+		});
+
+		// enough fountain chunks to reassemble the compressed payload, with a little overhead
+		unsigned chunkSize = cimbar::Config::fountain_chunk_size();
+		vector<string> chunks;
+		{
+			std::stringstream src(compressed);
+			fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(src, chunkSize);
+			string buff(chunkSize, '\0');
+			unsigned total = fes->blocks_required() + 2;
+			for (unsigned i = 0; i < total and fes->readsome(buff.data(), chunkSize) == chunkSize; ++i)
+				chunks.push_back(buff);
+		}
+		bench.run(modeName, "fountain_decoder_stream_write", chunks.size(), [&]() {
+			fountain_decoder_stream fds(compressed.size(), chunkSize);
+			for (const string& c : chunks)
+				if (fds.write(c.data(), c.size()))
+					break;
+			_sink += fds.progress();
+		});
+
+		bench.run(modeName, "zstd_decompress", 1, [&]() {
+			cimbar::zstd_decompressor<std::stringstream> dec;
+			dec.write(compressed.data(), compressed.size());
+			_sink += dec.tellp();
+		});
+	}
+
+	// nearest tile hash, for alphabets bigger than the ones we ship: the scan vs. the index.
+	// queries are a few bits off a random tile, like a (decent) cell would be.
+	void bench_symbol_index(Bench& bench)
+	{
+		std::mt19937_64 gen(1234);
+		for (unsigned numTiles : {16, 32, 64, 128, 256})
+		{
+			string name = fmt::format("{}tiles", numTiles);
+			vector<uint64_t> tiles(numTiles);
+			for (uint64_t& t : tiles)
+				t = gen();
+
+			vector<uint64_t> queries(1024);
+			for (uint64_t& q : queries)
+			{
+				q = tiles[gen() % numTiles];
+				for (unsigned flips = gen() % 12; flips > 0; --flips)
+					q ^= 1ULL << (gen() % 64);
+			}
+
+			bench.run(name, "nearest_scan", queries.size(), [&]() {
+				for (uint64_t q : queries)
+					_sink += image_hash::nearest(q, tiles.data(), tiles.size());
+			});
+
+			image_hash::hash_index index(tiles);
+			bench.run(name, "nearest_index", queries.size(), [&]() {
+				for (uint64_t q : queries)
+					_sink += index.nearest(q);
+			});
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cxxopts::Options options("cimbar_bench", "Microbenchmarks for the libcimbar decode kernels");
+	options.add_options()
+		("m,mode", "Modes to run. [4C,8C,B,Bm,Bu]", cxxopts::value<vector<string>>()->default_value("4C,8C,B,Bm,Bu"))
+		("k,kernel", "Only run these kernels.", cxxopts::value<vector<string>>())
+		("iterations", "Minimum iterations per kernel.", cxxopts::value<unsigned>()->default_value("10"))
+		("seconds", "Minimum time per kernel.", cxxopts::value<double>()->default_value("0.5"))
+		("size", "Size of the synthetic payload, in bytes.", cxxopts::value<unsigned>()->default_value("200000"))
+		("h,help", "Print usage")
+	;
+
+	auto result = options.parse(argc, argv);
+	if (result.count("help"))
+	{
+		std::cerr << options.help() << std::endl;
+		return 0;
+	}
+
+	BenchOptions opts;
+	opts.minIterations = result["iterations"].as<unsigned>();
+	opts.minSeconds = result["seconds"].as<double>();
+	if (result.count("kernel"))
+		opts.kernels = result["kernel"].as<vector<string>>();
+
+	FountainInit::init();
+	string data = synthetic_data(result["size"].as<unsigned>());
+
+	Bench bench(std::cout, opts);
+	for (const string& mode : result["mode"].as<vector<string>>())
+	{
+		int modeVal = -1;
+		if (mode == "4C" or mode == "4c")
+			modeVal = 4;
+		else if (mode == "8C" or mode == "8c")
+			modeVal = 8;
+		else if (mode == "Bu" or mode == "BU")
+			modeVal = 66;
+		else if (mode == "Bm" or mode == "BM")
+			modeVal = 67;
+		else if (mode == "B")
+			modeVal = 68;
+
+		if (modeVal < 0)
+		{
+			std::cerr << "unknown mode " << mode << std::endl;
+			return 1;
+		}
+		bench_mode(bench, mode, modeVal, data);
+	}
+	bench_symbol_index(bench);
+	return 0;
+}